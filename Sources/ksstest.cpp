@@ -8,31 +8,70 @@
 //
 
 #include <algorithm>
+#include <array>
 #include <atomic>
 #include <cassert>
+#include <cmath>
 #include <condition_variable>
+#include <cstdio>
+#include <cstring>
 #include <ctime>
+#include <deque>
 #include <exception>
 #include <filesystem>
 #include <fstream>
-#include <future>
 #include <iomanip>
 #include <iostream>
 #include <map>
 #include <mutex>
+#include <optional>
+#include <random>
 #include <ostream>
 #include <set>
 #include <sstream>
+#include <stdexcept>
 #include <string>
 #include <thread>
 #include <vector>
 
 #include <cxxabi.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <fcntl.h>
 #include <getopt.h>
 #include <signal.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/wait.h>
 
+#if defined(__APPLE__)
+#   include <mach/mach.h>
+#   include <malloc/malloc.h>
+#   include <sys/sysctl.h>
+#endif
+#if defined(__linux__)
+#   include <malloc.h>
+#   include <sched.h>
+#   include <linux/perf_event.h>
+#   include <sys/ioctl.h>
+#   include <sys/syscall.h>
+#endif
+
+// The sanitizers replace malloc, and have their own means of reporting its use.
+#if defined(__SANITIZE_ADDRESS__) || defined(__SANITIZE_THREAD__)
+#   define KSS_HAS_SANITIZER_ALLOCATOR 1
+#elif defined(__has_feature)
+#   if __has_feature(address_sanitizer) || __has_feature(thread_sanitizer)
+#       define KSS_HAS_SANITIZER_ALLOCATOR 1
+#   endif
+#endif
+#if defined(KSS_HAS_SANITIZER_ALLOCATOR)
+extern "C" size_t __sanitizer_get_current_allocated_bytes();
+#endif
+
 #include "ksstest.hpp"
 
 using namespace std;
@@ -45,6 +84,15 @@ using namespace kss::test;
 
 namespace {
     constexpr size_t maxFailureReportLineLength = 100;
+    constexpr size_t rangeChunkSize = 4096;                 // Elements checked per chunk.
+    constexpr size_t parallelRangeThreshold = 1 << 20;      // Elements before we go parallel.
+    constexpr size_t goldenBlockSize = 1 << 20;             // Bytes compared per block.
+    constexpr size_t goldenContextSize = 32;                // Bytes shown around a difference.
+    constexpr size_t coldCacheBufferSize = 64 << 20;        // Bytes written to evict the caches.
+    constexpr size_t cacheLineSize = 64;
+    constexpr double significanceLevel = 0.01;              // For the statistical assertions.
+    constexpr unsigned scalingRunsPerSize = 5;              // Timed runs of scalesAs, per size.
+    constexpr double scalingFitTolerance = 1.25;            // Residual ratio accepted by scalesAs.
 }
 
 // MARK: Simple XML streaming "borrowed" from kssutil
@@ -196,6 +244,194 @@ namespace { namespace xml {
             return _private::write_with_indent(strm, root, 0);
         }
     }
+
+    /*!
+     This namespace provides a minimal XML reader, sufficient for reading back what
+     simple_writer produces. It handles elements, attributes, text, comments and CDATA,
+     but not DTDs or namespaces, and the whole document is read into memory.
+     */
+    namespace simple_reader {
+
+        using namespace std;
+
+        /*!
+         An XML element with its attributes, text and children.
+         */
+        struct element {
+            string              name;
+            map<string, string> attributes;
+            string              text;
+            vector<element>     children;
+        };
+
+
+        // Don't call anything in this "namespace" manually.
+        struct _private {
+            const string&   doc;
+            size_t          pos = 0;
+
+            [[noreturn]] void fail(const string& what) const {
+                throw invalid_argument("Malformed XML at offset " + to_string(pos) + ": " + what);
+            }
+
+            bool startsWith(const char* s) const noexcept {
+                return doc.compare(pos, strlen(s), s) == 0;
+            }
+
+            void skipPast(const char* s) {
+                const auto end = doc.find(s, pos);
+                if (end == string::npos) { fail(string("missing ") + s); }
+                pos = end + strlen(s);
+            }
+
+            void skipSpace() noexcept {
+                while (pos < doc.size() && isspace((unsigned char)doc[pos])) { ++pos; }
+            }
+
+            // Skip any declarations, processing instructions and comments.
+            void skipMisc() {
+                for (skipSpace(); startsWith("<?") || startsWith("<!"); skipSpace()) {
+                    skipPast(startsWith("<!--") ? "-->" : ">");
+                }
+            }
+
+            string readName() {
+                const auto start = pos;
+                while (pos < doc.size() && !isspace((unsigned char)doc[pos])
+                       && doc[pos] != '=' && doc[pos] != '>' && doc[pos] != '/')
+                {
+                    ++pos;
+                }
+                if (pos == start) { fail("expected a name"); }
+                return doc.substr(start, pos - start);
+            }
+
+            static void appendUtf8(string& s, unsigned long cp) {
+                if (cp < 0x80) { s += char(cp); }
+                else if (cp < 0x800) { s += char(0xc0 | (cp >> 6)); s += char(0x80 | (cp & 0x3f)); }
+                else if (cp < 0x10000) {
+                    s += char(0xe0 | (cp >> 12));
+                    s += char(0x80 | ((cp >> 6) & 0x3f));
+                    s += char(0x80 | (cp & 0x3f));
+                }
+                else {
+                    s += char(0xf0 | (cp >> 18));
+                    s += char(0x80 | ((cp >> 12) & 0x3f));
+                    s += char(0x80 | ((cp >> 6) & 0x3f));
+                    s += char(0x80 | (cp & 0x3f));
+                }
+            }
+
+            string decode(size_t start, size_t end) const {
+                string buffer;
+                buffer.reserve(end - start);
+                while (start < end) {
+                    if (doc[start] != '&') {
+                        buffer += doc[start++];
+                        continue;
+                    }
+                    const auto semi = doc.find(';', start);
+                    if (semi == string::npos || semi > end) {
+                        buffer += doc[start++];
+                        continue;
+                    }
+                    const auto entity = doc.substr(start + 1, semi - start - 1);
+                    if (entity == "amp") { buffer += '&'; }
+                    else if (entity == "quot") { buffer += '"'; }
+                    else if (entity == "apos") { buffer += '\''; }
+                    else if (entity == "lt") { buffer += '<'; }
+                    else if (entity == "gt") { buffer += '>'; }
+                    else if (entity.size() > 1 && entity[0] == '#') {
+                        const bool isHex = (entity[1] == 'x' || entity[1] == 'X');
+                        appendUtf8(buffer, strtoul(entity.c_str() + (isHex ? 2 : 1), nullptr, isHex ? 16 : 10));
+                    }
+                    else {
+                        buffer.append(doc, start, semi - start + 1);
+                    }
+                    start = semi + 1;
+                }
+                return buffer;
+            }
+
+            element readElement() {
+                element e;
+                if (!startsWith("<")) { fail("expected an element"); }
+                ++pos;
+                e.name = readName();
+
+                // Read the attributes.
+                for (skipSpace(); pos < doc.size() && doc[pos] != '>' && doc[pos] != '/'; skipSpace()) {
+                    const auto key = readName();
+                    skipSpace();
+                    if (!startsWith("=")) { fail("expected '=' after " + key); }
+                    ++pos;
+                    skipSpace();
+                    if (pos >= doc.size() || (doc[pos] != '"' && doc[pos] != '\'')) { fail("expected a quote"); }
+                    const auto quote = doc[pos++];
+                    const auto end = doc.find(quote, pos);
+                    if (end == string::npos) { fail("unterminated attribute " + key); }
+                    e.attributes[key] = decode(pos, end);
+                    pos = end + 1;
+                }
+                if (startsWith("/>")) {
+                    pos += 2;
+                    return e;
+                }
+                if (!startsWith(">")) { fail("unterminated element " + e.name); }
+                ++pos;
+
+                // Read the contents.
+                while (true) {
+                    const auto start = pos;
+                    const auto end = doc.find('<', pos);
+                    if (end == string::npos) { fail("missing </" + e.name + ">"); }
+                    e.text += decode(start, end);
+                    pos = end;
+                    if (startsWith("</")) {
+                        pos += 2;
+                        if (readName() != e.name) { fail("mismatched </" + e.name + ">"); }
+                        skipPast(">");
+                        break;
+                    }
+                    else if (startsWith("<!--")) {
+                        skipPast("-->");
+                    }
+                    else if (startsWith("<![CDATA[")) {
+                        const auto cdata = pos + 9;
+                        skipPast("]]>");
+                        e.text.append(doc, cdata, pos - 3 - cdata);
+                    }
+                    else if (startsWith("<?")) {
+                        skipPast("?>");
+                    }
+                    else {
+                        e.children.push_back(readElement());
+                    }
+                }
+
+                // Indentation is not considered part of the text.
+                const auto first = e.text.find_first_not_of(" \t\r\n");
+                e.text = (first == string::npos
+                          ? string()
+                          : e.text.substr(first, e.text.find_last_not_of(" \t\r\n") - first + 1));
+                return e;
+            }
+        };
+
+
+        /*!
+         Read an XML document, returning its root element.
+         @throws std::invalid_argument if the document is not well formed.
+         */
+        inline element read(const string& doc) {
+            _private p { doc };
+            p.skipMisc();
+            auto root = p.readElement();
+            p.skipMisc();
+            if (p.pos != doc.size()) { p.fail("unexpected content after the root element"); }
+            return root;
+        }
+    }
 }}
 
 
@@ -376,6 +612,186 @@ namespace { namespace json {
         }
     }
 
+    /*!
+     This namespace provides a minimal JSON reader, sufficient for reading back what
+     simple_writer produces. It has the same restrictions: the document is an object,
+     objects contain only values and arrays of objects, and values (strings, numbers,
+     booleans and null) are all read as strings.
+     */
+    namespace simple_reader {
+
+        using namespace std;
+
+        /*!
+         A JSON object, with its values in attributes and its arrays of objects in arrays.
+         */
+        struct node {
+            map<string, string>         attributes;
+            map<string, vector<node>>   arrays;
+        };
+
+
+        // Don't call anything in this namespace manually.
+        struct _private {
+            const string&   doc;
+            size_t          pos = 0;
+
+            [[noreturn]] void fail(const string& what) const {
+                throw invalid_argument("Malformed JSON at offset " + to_string(pos) + ": " + what);
+            }
+
+            void skipSpace() noexcept {
+                while (pos < doc.size() && isspace((unsigned char)doc[pos])) { ++pos; }
+            }
+
+            // Surrogate pairs are not combined, which is fine for the reports we read.
+            static void appendUtf8(string& s, unsigned long cp) {
+                if (cp < 0x80) { s += char(cp); }
+                else if (cp < 0x800) { s += char(0xc0 | (cp >> 6)); s += char(0x80 | (cp & 0x3f)); }
+                else {
+                    s += char(0xe0 | (cp >> 12));
+                    s += char(0x80 | ((cp >> 6) & 0x3f));
+                    s += char(0x80 | (cp & 0x3f));
+                }
+            }
+
+            bool consume(char ch) noexcept {
+                skipSpace();
+                if (pos < doc.size() && doc[pos] == ch) {
+                    ++pos;
+                    return true;
+                }
+                return false;
+            }
+
+            void expect(char ch) {
+                if (!consume(ch)) { fail(string("expected '") + ch + "'"); }
+            }
+
+            string readString() {
+                expect('"');
+                string s;
+                while (pos < doc.size() && doc[pos] != '"') {
+                    const auto ch = doc[pos++];
+                    if (ch != '\\') {
+                        s += ch;
+                        continue;
+                    }
+                    if (pos >= doc.size()) { break; }
+                    switch (const auto esc = doc[pos++]) {
+                        case 'b': s += '\b'; break;
+                        case 'f': s += '\f'; break;
+                        case 'n': s += '\n'; break;
+                        case 'r': s += '\r'; break;
+                        case 't': s += '\t'; break;
+                        case 'u':
+                            if (pos + 4 > doc.size()) { fail("truncated \\u escape"); }
+                            appendUtf8(s, strtoul(doc.substr(pos, 4).c_str(), nullptr, 16));
+                            pos += 4;
+                            break;
+                        default: s += esc; break;
+                    }
+                }
+                expect('"');
+                return s;
+            }
+
+            // Numbers, booleans and null.
+            string readLiteral() {
+                skipSpace();
+                const auto start = pos;
+                while (pos < doc.size() && (isalnum((unsigned char)doc[pos]) || strchr("+-.", doc[pos]))) {
+                    ++pos;
+                }
+                if (pos == start) { fail("expected a value"); }
+                return doc.substr(start, pos - start);
+            }
+
+            node readObject() {
+                node n;
+                expect('{');
+                if (consume('}')) {
+                    return n;
+                }
+                do {
+                    const auto key = readString();
+                    expect(':');
+                    skipSpace();
+                    if (consume('[')) {
+                        auto& arr = n.arrays[key];
+                        if (!consume(']')) {
+                            do {
+                                arr.push_back(readObject());
+                            } while (consume(','));
+                            expect(']');
+                        }
+                    }
+                    else if (pos < doc.size() && doc[pos] == '"') {
+                        n.attributes[key] = readString();
+                    }
+                    else {
+                        n.attributes[key] = readLiteral();
+                    }
+                } while (consume(','));
+                expect('}');
+                return n;
+            }
+
+            // Like readObject, but returns only the value of the given key, reading no
+            // further than it.
+            optional<string> readAttributeOfObject(const string& wanted) {
+                expect('{');
+                if (consume('}')) {
+                    return nullopt;
+                }
+                do {
+                    const auto key = readString();
+                    expect(':');
+                    skipSpace();
+                    if (consume('[')) {
+                        if (!consume(']')) {
+                            do {
+                                (void) readObject();
+                            } while (consume(','));
+                            expect(']');
+                        }
+                    }
+                    else {
+                        auto value = (pos < doc.size() && doc[pos] == '"' ? readString() : readLiteral());
+                        if (key == wanted) {
+                            return value;
+                        }
+                    }
+                } while (consume(','));
+                expect('}');
+                return nullopt;
+            }
+        };
+
+
+        /*!
+         Read a JSON document, returning its top level object.
+         @throws std::invalid_argument if the document is not of the supported form.
+         */
+        inline node read(const string& doc) {
+            _private p { doc };
+            auto root = p.readObject();
+            p.skipSpace();
+            if (p.pos != doc.size()) { p.fail("unexpected content after the object"); }
+            return root;
+        }
+
+        /*!
+         Read the value of a single key of the top level object of a JSON document, which
+         is quicker than reading all of it. Returns nullopt if the key is not present.
+         @throws std::invalid_argument if the document is malformed before the key.
+         */
+        inline optional<string> readAttribute(const string& doc, const string& key) {
+            _private p { doc };
+            return p.readAttributeOfObject(key);
+        }
+    }
+
 } }
 
 
@@ -401,27 +817,86 @@ namespace {
 
     using failures_t = vector<pair<string, string>>;
 
+    // An atomic counter that can still be moved, which is needed since the test cases
+    // are kept in (and sorted in) a vector. Moving is only valid while no other threads
+    // are using the counter.
+    struct AssertionCounter {
+        atomic<unsigned> value { 0 };
+
+        AssertionCounter() = default;
+        AssertionCounter(AssertionCounter&& rhs) noexcept : value(rhs.value.load()) {}
+        AssertionCounter& operator=(AssertionCounter&& rhs) noexcept {
+            value = rhs.value.load();
+            return *this;
+        }
+
+        void increment() noexcept { value.fetch_add(1, memory_order_relaxed); }
+        void add(unsigned n) noexcept { value.fetch_add(n, memory_order_relaxed); }
+        operator unsigned() const noexcept { return value.load(); }
+    };
+
+    struct TestSuiteWrapper;
+
     struct TestCaseWrapper {
         string                  name;
         TestSuite*              owner = nullptr;
+        TestSuiteWrapper*       suiteWrapper = nullptr;
         TestSuite::test_case_fn fn;
-        unsigned int            assertions = 0;
+        AssertionCounter        assertions;
         vector<TestError>       errors;
-        failures_t              failures;
+        failures_t              failures;       // Guarded by failuresLock while running.
         bool                    skipped = false;
-        duration<double>        durationOfTest;
-        string                  mostRecentDetails;
+        duration<double>        durationOfTest {};
+        uint64_t                seed = 0;
+
+        // The following are only used when repeating (--repeat or --until-failure), in
+        // which case durationOfTest is the total, and the errors and failures are those
+        // of the first iteration that failed.
+        unsigned                iterations = 0;
+        unsigned                failedIterations = 0;
+        double                  sumOfSquaredDurations = 0.0;
+        long                    firstFailedIteration = -1;
+
+        // The following are only used with --retries. A test case that failed and then
+        // passed when it was retried is flaky. Its errors and failures are then those of
+        // the attempts that failed, and are reported apart from those of the test cases
+        // that failed.
+        unsigned                retries = 0;
+        bool                    flaky = false;
+        vector<TestError>       flakyErrors;
+        failures_t              flakyFailures;
+
+        // Set for the temporary wrappers of repetitions and retries.
+        const TestCaseWrapper*  original = nullptr;
+
+        // Only used with --perf-counters.
+        map<string, uint64_t>   counters;
+
+        // Values measured by assertions (such as the fits of scalesAs) to be added to the
+        // reports. Guarded by failuresLock while running.
+        map<string, string>     measurements;
+
+        // Set for the BeforeAll and AfterAll "tests", which are run once around the others.
+        bool                    isBeforeAll = false;
+        bool                    isAfterAll = false;
 
         bool operator<(const TestCaseWrapper& rhs) const noexcept {
             return name < rhs.name;
         }
     };
 
+    bool isFixture(const TestCaseWrapper& t) noexcept {
+        return t.isBeforeAll || t.isAfterAll;
+    }
+
     struct TestSuiteWrapper {
         TestSuite*          suite;
         bool                filteredOut = false;
+        bool                cancelled = false;      // Not run due to --stop-on-first-failure.
+        bool                isPrerequisite = false; // Needed by a suite that passes the filter.
         string              timestamp;
-        duration<double>    durationOfTestSuite;
+        duration<double>    durationOfTestSuite {};
+        thread::id          ranOn;                  // The thread that ran the suite.
         unsigned            numberOfErrors = 0;
         unsigned            numberOfFailedAssertions = 0;
         unsigned            numberOfSkippedTests = 0;
@@ -434,13 +909,71 @@ namespace {
 
     thread_local static TestSuiteWrapper*   currentSuite = nullptr;
     thread_local static TestCaseWrapper*    currentTest = nullptr;
+    thread_local static string              mostRecentDetails;
+    static mutex                            failuresLock;
     static bool                             isQuietMode = false;
     static bool                             isVerboseMode = false;
     static bool                             isParallel = true;
     static bool                             stopOnFirstFailure = false;
+    static atomic<bool>                     isCancelled { false };
+    static bool                             updateGoldenFiles = false;
     static string                           filter;
     static string                           xmlReportFilename;
     static string                           jsonReportFilename;
+    static string                           failedFirstFilename;
+    static map<string, unsigned>            resourceCapacities;
+    static string                           memoryEstimatesFilename;
+    static unsigned                         repeatCount = 1;        // 0 means no limit.
+    static bool                             repeatUntilFailure = false;
+    static uint64_t                         runSeed = 0;
+    static bool                             hasRunSeed = false;
+    static unsigned                         retryCount = 0;
+    static string                           rerunFailedFilename;
+    static map<string, set<string>>         testCasesToRerun;       // Test case names by suite.
+    static string                           traceFilename;
+    static string                           tapFilename;
+    static string                           profileDirectory;
+    static bool                             usePerformanceCounters = false;
+    static bool                             pinTimedCode = false;
+    static int                              pinnedCpu = -1;         // -1 means the current one.
+    static bool                             useColdCache = false;
+    static string                           fixtureCacheDirectory;  // Empty means the default.
+    static unsigned                         numberOfSlowestToShow = 0;
+    static double                           suiteTimeBudget = 0.0;  // Seconds, 0 means no budget.
+    static thread::id                       mainThreadId;
+
+    // Returns true if the test cases are being run repeatedly.
+    inline bool isRepeating() noexcept {
+        return (repeatCount != 1 || repeatUntilFailure);
+    }
+
+    // Statistics of a repeated test case.
+    double meanDuration(const TestCaseWrapper& t) noexcept {
+        return (t.iterations > 0 ? t.durationOfTest.count() / t.iterations : 0.0);
+    }
+
+    double standardDeviationOfDuration(const TestCaseWrapper& t) noexcept {
+        if (t.iterations == 0) {
+            return 0.0;
+        }
+        const auto mean = meanDuration(t);
+        return sqrt(max(0.0, t.sumOfSquaredDurations / t.iterations - mean * mean));
+    }
+
+    double passRate(const TestCaseWrapper& t) noexcept {
+        return (t.iterations > 0 ? double(t.iterations - t.failedIterations) / t.iterations : 0.0);
+    }
+
+    string describeRepetitions(const TestCaseWrapper& t) {
+        ostringstream strm;
+        strm << "passed " << (t.iterations - t.failedIterations) << " of " << t.iterations
+            << (t.iterations == 1 ? " iteration" : " iterations")
+            << ", mean time " << meanDuration(t) << "s, std dev " << standardDeviationOfDuration(t) << "s";
+        if (t.firstFailedIteration >= 0) {
+            strm << ", first failed at iteration " << t.firstFailedIteration << " with seed " << t.seed;
+        }
+        return strm.str();
+    }
 
     // Lazy instantiation of the testSuites singleton.
     vector<TestSuiteWrapper>* testSuites() {
@@ -456,12 +989,16 @@ namespace {
         string              programName;
         string              nameOfTestRun;
         string              nameOfHost;
+        string              cpuModel;
+        string              cpuGovernor;
+        string              loadAverage;
         string              timeOfTestRun;
         duration<double>    durationOfTestRun;
         unsigned            numberOfErrors = 0;
         unsigned            numberOfFailures = 0;
         unsigned            numberOfAssertions = 0;
         unsigned            numberOfTests = 0;
+        unsigned            numberOfFlakyTests = 0;
     };
     static TestResultSummary reportSummary;
 }
@@ -494,15 +1031,6 @@ namespace {
     // Exception that is thrown to skip a test case.
     class SkipTestCase {};
 
-    // Signal handler to allow us to ignore SIGCHLD.
-    void my_signal_handler(int sig) {
-    }
-
-    // Terminate handler allowing us to catch the terminate call.
-    void my_terminate_handler() {
-        _exit(0);           // Correct response.
-    }
-
     // Parse the command line. Returns true if we should continue or false if we
     // should exit.
     static const struct option commandLineOptions[] = {
@@ -514,6 +1042,24 @@ namespace {
         { "json", required_argument, nullptr, 'J' },
         { "no-parallel", no_argument, nullptr, 'N' },
         { "stop-on-first-failure", no_argument, nullptr, 'S' },
+        { "update-golden", no_argument, nullptr, 'G' },
+        { "failed-first", required_argument, nullptr, 'F' },
+        { "memory-budget", required_argument, nullptr, 'M' },
+        { "memory-estimates", required_argument, nullptr, 'E' },
+        { "repeat", required_argument, nullptr, 'R' },
+        { "until-failure", no_argument, nullptr, 'U' },
+        { "seed", required_argument, nullptr, 'D' },
+        { "retries", required_argument, nullptr, 'T' },
+        { "rerun-failed", required_argument, nullptr, 'P' },
+        { "trace", required_argument, nullptr, 'A' },
+        { "tap", required_argument, nullptr, 'L' },
+        { "profile", required_argument, nullptr, 'O' },
+        { "perf-counters", no_argument, nullptr, 'C' },
+        { "pin-cpu", optional_argument, nullptr, 'I' },
+        { "cold-cache", no_argument, nullptr, 'K' },
+        { "fixture-cache", required_argument, nullptr, 'Y' },
+        { "slowest", required_argument, nullptr, 'W' },
+        { "suite-time-budget", required_argument, nullptr, 'B' },
         { nullptr, 0, nullptr, 0 }
     };
 
@@ -544,10 +1090,57 @@ The following are the accepted command line options:
 -f <testprefix>/--filter=<testprefix> only run tests that start with the prefix
 --xml=<filename> writes a JUnit test compatible XML to the given filename
 --json=<filename> writes a gUnit test compatible JSON to the given filename
+--tap=<filename> streams the result of each test case, as it finishes, to the given
+    filename in the Test Anything Protocol (TAP version 13)
 --no-parallel will force all tests to be run in the same thread (This is assumed if
     the --verbose option is specified.)
 --stop-on-first-failure will cause the test program to stop shortly after the first failure
-    or error has been detected.
+    or error has been detected. Test cases that are already running are allowed to finish,
+    no further ones are started, and the reports are written for what did run.
+--failed-first=<filename> runs the test suites that failed in the previous run before the
+    others. The names of the failed test suites are kept in the given file.
+--memory-budget=<megabytes> limits the memory that test suites running in parallel are
+    expected to use. (See UsesResources.) The default is the physical memory.
+--memory-estimates=<filename> measures the peak memory allocated by each test suite and
+    keeps it in the given file. Suites that do not declare their memory use are expected
+    to use what was measured in the previous run. Memory allocated while several suites
+    are running is shared equally between them, so the measurements are most accurate
+    with --no-parallel.
+--repeat=<count> runs each test case the given number of times, reporting how often each
+    passed along with the mean and standard deviation of their durations. Test suites
+    that inherit from MayRepeatInParallel have their repetitions spread across threads.
+--until-failure keeps repeating (up to --repeat times, if given) until a test case fails,
+    at which point the test run stops as for --stop-on-first-failure.
+--seed=<number> sets the seed returned by seed(). (Each repetition adds 1 to it.) The seed
+    of the first failing repetition of each test case is reported, allowing it to be rerun.
+--retries=<count> reruns a failed test case (along with its BeforeEach and AfterEach) up to
+    the given number of times once the other test cases of its suite have run. If it then
+    passes it is reported as flaky, along with the failures of its earlier attempts,
+    rather than failed. (This is ignored when repeating.)
+--rerun-failed=<filename> reads an XML or JSON report written by an earlier run and runs
+    only the test cases that failed or had errors in it. This implies --verbose.
+--trace=<filename> writes a timeline of the test run, showing when each test suite and test
+    case ran on each thread, in the Chrome trace event format. View it with Perfetto
+    (https://ui.perfetto.dev) or chrome://tracing.
+--profile=<directory> samples the stacks of the threads running the tests (1000 times per
+    second of CPU time) and writes them to the directory, one file per test suite, as
+    folded stacks for flame graph tools. Each stack starts with the test case's name. The
+    files are named after the suites, with unsafe characters written as "%XX".
+--perf-counters adds the counts of CPU events (cycles, instructions, cache misses and branch
+    misses) caused by each test case to the XML and JSON reports. Where those are not
+    available, the CPU time and page faults are given instead. (Linux only.)
+--pin-cpu[=<cpu>] pins the thread to a single CPU (by default the one it is running on)
+    while completesWithin and the other timing assertions run their code. (Linux only.)
+--cold-cache evicts the CPU caches, by writing to a large buffer, before each call that
+    the timing assertions time, so that they measure the code with cold caches.
+--slowest=<count> adds a performance section to the summary, listing the given number of
+    slowest test suites and test cases, and how well the threads were kept busy.
+--suite-time-budget=<seconds> flags, in the summary, the test suites that took longer than
+    the given time.
+--fixture-cache=<directory> keeps the fixtures built by cachedFixture in the given directory
+    instead of "ksstest-fixture-cache" in the temporary directory.
+--update-golden will cause matchesGoldenFile to replace the golden files with the actual
+    contents instead of comparing against them.
 
 The display options essentially run in three modes.
 
@@ -612,12 +1205,57 @@ times that KSS_ASSERT failed) in all the test cases in all the test suites.
         return string(optarg);
     }
 
+    // Obtain the required argument as a number or print a usage message and exit if it is
+    // not one.
+    uint64_t getUnsignedLongArgument() {
+        const auto arg = getArgument();
+        char* end = nullptr;
+        errno = 0;
+        const auto value = strtoull(arg.c_str(), &end, 10);
+        if (arg.empty() || *end != '\0' || errno != 0) {
+            printUsageMessage(cerr);
+            exit(-1);
+        }
+        return uint64_t(value);
+    }
+
+    // Obtain the required argument as a positive number or print a usage message and exit
+    // if it is not one.
+    unsigned getUnsignedArgument() {
+        const auto arg = getArgument();
+        char* end = nullptr;
+        errno = 0;
+        const auto value = strtoul(arg.c_str(), &end, 10);
+        if (arg.empty() || *end != '\0' || errno != 0 || value == 0
+            || value > numeric_limits<unsigned>::max())
+        {
+            printUsageMessage(cerr);
+            exit(-1);
+        }
+        return unsigned(value);
+    }
+
+    // Obtain the required argument as a positive (possibly fractional) number or print a
+    // usage message and exit if it is not one.
+    double getPositiveNumberArgument() {
+        const auto arg = getArgument();
+        char* end = nullptr;
+        errno = 0;
+        const auto value = strtod(arg.c_str(), &end);
+        if (arg.empty() || *end != '\0' || errno != 0 || !(value > 0.0)) {
+            printUsageMessage(cerr);
+            exit(-1);
+        }
+        return value;
+    }
+
     // Parse the command line and setup the global state of the world with the results.
     bool parseCommandLine(int argc, const char* const* argv) {
         if (argc > 0 && argv != nullptr) {
             char** newargv = duplicateArgv(argc, argv);
             finally cleanup([&]{ free(newargv); });
 
+            bool hasRepeatCount = false;
             int ch = 0;
             while ((ch = getopt_long(argc, newargv, "hqvf:", commandLineOptions, nullptr)) != -1) {
                 switch (ch) {
@@ -645,16 +1283,92 @@ times that KSS_ASSERT failed) in all the test cases in all the test suites.
                     case 'S':
                         stopOnFirstFailure = true;
                         break;
+                    case 'G':
+                        updateGoldenFiles = true;
+                        break;
+                    case 'F':
+                        failedFirstFilename = getArgument();
+                        break;
+                    case 'M':
+                        resourceCapacities["memoryMB"] = getUnsignedArgument();
+                        break;
+                    case 'E':
+                        memoryEstimatesFilename = getArgument();
+                        break;
+                    case 'R':
+                        repeatCount = getUnsignedArgument();
+                        hasRepeatCount = true;
+                        break;
+                    case 'U':
+                        repeatUntilFailure = true;
+                        break;
+                    case 'D':
+                        runSeed = getUnsignedLongArgument();
+                        hasRunSeed = true;
+                        break;
+                    case 'T':
+                        retryCount = getUnsignedArgument();
+                        break;
+                    case 'P':
+                        rerunFailedFilename = getArgument();
+                        break;
+                    case 'A':
+                        traceFilename = getArgument();
+                        break;
+                    case 'L':
+                        tapFilename = getArgument();
+                        break;
+                    case 'O':
+                        profileDirectory = getArgument();
+                        break;
+                    case 'C':
+                        usePerformanceCounters = true;
+                        break;
+                    case 'I':
+                        pinTimedCode = true;
+                        if (optarg) {
+                            const auto cpu = getUnsignedLongArgument();
+                            if (cpu > uint64_t(numeric_limits<int>::max())) {
+                                printUsageMessage(cerr);
+                                exit(-1);
+                            }
+                            pinnedCpu = int(cpu);
+                        }
+                        break;
+                    case 'K':
+                        useColdCache = true;
+                        break;
+                    case 'Y':
+                        fixtureCacheDirectory = getArgument();
+                        break;
+                    case 'W':
+                        numberOfSlowestToShow = getUnsignedArgument();
+                        break;
+                    case 'B':
+                        suiteTimeBudget = getPositiveNumberArgument();
+                        break;
                 }
             }
 
             // Fix any command line dependances.
+            if (!rerunFailedFilename.empty()) {
+                isVerboseMode = true;
+            }
             if (isQuietMode) {
                 isVerboseMode = false;
             }
             if (isVerboseMode) {
                 isParallel = false;
             }
+            if (repeatUntilFailure) {
+                stopOnFirstFailure = true;
+                if (!hasRepeatCount) {
+                    repeatCount = 0;
+                }
+            }
+        }
+        if (!hasRunSeed) {
+            runSeed = random_device()();
         }
         return true;
     }
@@ -666,6 +1380,9 @@ times that KSS_ASSERT failed) in all the test cases in all the test suites.
 
     // Returns true if the test case should pass the filter and false otherwise.
     bool passesFilter(const TestSuite& s) noexcept {
+        if (!rerunFailedFilename.empty() && testCasesToRerun.count(s.name()) == 0) {
+            return false;
+        }
         if (!filter.empty()) {
             return starts_with(s.name(), filter);
         }
@@ -687,6 +1404,94 @@ times that KSS_ASSERT failed) in all the test cases in all the test suites.
         if (strm.bad()) { throwProcessingError(filename, "Failed while writing"); }
     }
 
+    // Write a file such that readers see either the old contents or the new, never a
+    // partially written file. Any missing parent directories are created.
+    void write_file_atomically(const string& filename, function<void (ofstream&)> fn) {
+        static atomic<unsigned> counter { 0 };
+        const auto parent = path(filename).parent_path();
+        if (!parent.empty()) {
+            create_directories(parent);
+        }
+
+        const auto tmpFilename = filename + ".tmp." + to_string(getpid())
+            + "." + to_string(counter++);
+        try {
+            write_file(tmpFilename, fn);
+            errno = 0;
+            if (::rename(tmpFilename.c_str(), filename.c_str()) == -1) {
+                throwProcessingError(filename, "Failed to rename to");
+            }
+        }
+        catch (...) {
+            error_code ec;
+            std::filesystem::remove(tmpFilename, ec);
+            throw;
+        }
+    }
+
+    // Returns name with every character that is not safe to use in a filename written as
+    // "%XX" (its code in hex). Different names always give different results.
+    string fileSafeEscaped(const string& name) {
+        static constexpr char hexDigits[] = "0123456789ABCDEF";
+        string escaped;
+        escaped.reserve(name.size());
+        for (const auto ch : name) {
+            if (isalnum((unsigned char)ch) || ch == '-' || ch == '_' || ch == '.') {
+                escaped += ch;
+            }
+            else {
+                escaped += '%';
+                escaped += hexDigits[(unsigned char)ch >> 4];
+                escaped += hexDigits[(unsigned char)ch & 0xf];
+            }
+        }
+        return escaped;
+    }
+
+    // Read-only memory mapping of an entire file.
+    class MappedFile {
+    public:
+        explicit MappedFile(const string& filename) {
+            errno = 0;
+            const int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd == -1) { throwProcessingError(filename, "Failed to open"); }
+            finally cleanup([fd]{ ::close(fd); });
+
+            struct stat st;
+            if (::fstat(fd, &st) == -1) { throwProcessingError(filename, "Failed to stat"); }
+            _size = size_t(st.st_size);
+            if (_size > 0) {
+                void* ptr = ::mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (ptr == MAP_FAILED) { throwProcessingError(filename, "Failed to map"); }
+                _data = static_cast<const char*>(ptr);
+            }
+        }
+
+        ~MappedFile() noexcept {
+            if (_data) {
+                ::munmap(const_cast<char*>(_data), _size);
+            }
+        }
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        // Hint to the kernel how the mapping will be accessed (e.g. MADV_SEQUENTIAL).
+        void advise(int advice) const noexcept {
+            if (_data) {
+                (void) ::madvise(const_cast<char*>(_data), _size, advice);
+            }
+        }
+
+        const char* data() const noexcept   { return _data; }
+        size_t size() const noexcept        { return _size; }
+        string_view view() const noexcept   { return string_view(_data, _size); }
+
+    private:
+        const char* _data = nullptr;
+        size_t      _size = 0;
+    };
+
     // Return the time that fn took to run.
     duration<double> timeOfExecution(function<void ()> fn) {
         const auto start = steady_clock::now();
@@ -694,15 +1499,133 @@ times that KSS_ASSERT failed) in all the test cases in all the test suites.
         return duration_cast<duration<double>>(steady_clock::now() - start);
     }
 
+    // Pins the calling thread to a single CPU, when --pin-cpu was given, for the lifetime
+    // of the object, so that timed code is not moved between CPUs. The previous affinity is
+    // restored afterwards. This does nothing on systems other than Linux.
+    class CpuPin {
+    public:
+        CpuPin() {
+#if defined(__linux__)
+            if (pinTimedCode) {
+                if (sched_getaffinity(0, sizeof(_previous), &_previous) == -1) {
+                    throw system_error(errno, system_category(), "Failed to get the CPU affinity");
+                }
+                const int cpu = (pinnedCpu >= 0 ? pinnedCpu : sched_getcpu());
+                if (cpu == -1) {
+                    throw system_error(errno, system_category(), "Failed to get the current CPU");
+                }
+                cpu_set_t cpus;
+                CPU_ZERO(&cpus);
+                CPU_SET(cpu, &cpus);
+                if (sched_setaffinity(0, sizeof(cpus), &cpus) == -1) {
+                    throw system_error(errno, system_category(),
+                                       "Failed to pin the thread to CPU " + to_string(cpu));
+                }
+                _isPinned = true;
+            }
+#endif
+        }
+
+        ~CpuPin() noexcept {
+#if defined(__linux__)
+            if (_isPinned) {
+                sched_setaffinity(0, sizeof(_previous), &_previous);
+            }
+#endif
+        }
+
+        CpuPin(const CpuPin&) = delete;
+        CpuPin& operator=(const CpuPin&) = delete;
+
+    private:
+#if defined(__linux__)
+        cpu_set_t   _previous;
+#endif
+        bool        _isPinned = false;
+    };
+
+    // When --cold-cache was given, evict the data of the code about to be timed from the
+    // CPU caches by writing to a buffer that is larger than them.
+    void prepareCachesForTiming() {
+        if (useColdCache) {
+            thread_local unique_ptr<char[]> buffer;
+            if (!buffer) {
+                buffer = make_unique<char[]>(coldCacheBufferSize);
+            }
+            for (size_t i = 0; i < coldCacheBufferSize; i += cacheLineSize) {
+                ++buffer[i];
+            }
+            clobberMemory();
+        }
+    }
+
     // Return the current timestamp in ISO 8601 format.
     string now() {
         time_t now;
         ::time(&now);
+        struct tm tmbuf;
         char buf[sizeof "9999-99-99T99:99:99Z "];
-        strftime(buf, sizeof(buf), "%FT%TZ", ::gmtime(&now));
+        strftime(buf, sizeof(buf), "%FT%TZ", ::gmtime_r(&now, &tmbuf));
         return string(buf);
     }
 
+    // Returns the physical memory of the machine in megabytes.
+    unsigned physicalMemoryMB() noexcept {
+        const long pages = sysconf(_SC_PHYS_PAGES);
+        const long pageSize = sysconf(_SC_PAGESIZE);
+        if (pages <= 0 || pageSize <= 0) {
+            return numeric_limits<unsigned>::max();
+        }
+        return unsigned(uint64_t(pages) * uint64_t(pageSize) / (1024 * 1024));
+    }
+
+    // Returns the current resident set size of the process in bytes, or 0 if it cannot
+    // be determined.
+    size_t residentSetSize() noexcept {
+#if defined(__APPLE__)
+        mach_task_basic_info info;
+        mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+        if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count) != KERN_SUCCESS) {
+            return 0;
+        }
+        return size_t(info.resident_size);
+#else
+        // This is called often, hence the C calls rather than an ifstream.
+        const int fd = ::open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            return 0;
+        }
+        char buf[128];
+        const auto n = ::read(fd, buf, sizeof(buf) - 1);
+        ::close(fd);
+        if (n <= 0) {
+            return 0;
+        }
+        buf[n] = '\0';
+        unsigned long long pages = 0, residentPages = 0;
+        if (sscanf(buf, "%llu %llu", &pages, &residentPages) != 2) {
+            return 0;
+        }
+        return size_t(residentPages) * size_t(sysconf(_SC_PAGESIZE));
+#endif
+    }
+
+    // Returns the memory that the process has allocated through malloc, and not yet freed,
+    // in bytes. Unlike the resident set size this goes down again when memory is freed.
+    // Where it cannot be determined the resident set size is returned instead.
+    size_t memoryInUse() noexcept {
+#if defined(KSS_HAS_SANITIZER_ALLOCATOR)
+        return __sanitizer_get_current_allocated_bytes();
+#elif defined(__APPLE__)
+        return size_t(mstats().bytes_used);
+#elif defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+        const auto info = mallinfo2();
+        return info.uordblks + info.hblkhd;
+#else
+        return residentSetSize();
+#endif
+    }
+
     // Returns the hostname of the machine.
     string hostname() noexcept {
         char name[100];
@@ -711,690 +1634,3620 @@ times that KSS_ASSERT failed) in all the test cases in all the test suites.
         }
         return name;
     }
-}
-
-
-// MARK: TestSuite::Impl Implementation
 
-struct TestSuite::Impl {
-    TestSuite*                parent = nullptr;
-    string                    name;
-    vector<TestCaseWrapper>   tests;
-
-    // Add the BeforeAll and AfterAll "tests" if appropriate.
-    void addBeforeAndAfterAll() {
-        if (auto* hba = as<HasBeforeAll>(parent)) {
-            TestCaseWrapper wrapper;
-            wrapper.name = "BeforeAll";
-            wrapper.owner = parent;
-            wrapper.fn = [hba] { hba->beforeAll(); };
-            tests.insert(tests.begin(), move(wrapper));
+    // Returns the model name of the CPU, or an empty string if it cannot be determined.
+    string cpuModel() {
+#if defined(__APPLE__)
+        char name[256];
+        size_t len = sizeof(name);
+        if (sysctlbyname("machdep.cpu.brand_string", name, &len, nullptr, 0) == -1) {
+            return "";
         }
-        if (auto* haa = as<HasAfterAll>(parent)) {
-            TestCaseWrapper wrapper;
-            wrapper.name = "AfterAll";
-            wrapper.owner = parent;
-            wrapper.fn = [haa] { haa->afterAll(); };
-            tests.push_back(move(wrapper));
+        return string(name);
+#else
+        ifstream strm("/proc/cpuinfo");
+        string line;
+        while (getline(strm, line)) {
+            const auto pos = line.find(':');
+            if (starts_with(line, "model name") && pos != string::npos) {
+                const auto start = line.find_first_not_of(" \t", pos+1);
+                return (start == string::npos ? string() : line.substr(start));
+            }
         }
+        return "";
+#endif
     }
 
-    // Run a test.
-    void runTestCase(TestCaseWrapper& t) {
-        currentTest = &t;
-        try {
-            t.durationOfTest = timeOfExecution([&]{
-                if (auto* hbe = as<HasBeforeEach>(parent)) {
-                    if (t.name != "BeforeAll" && t.name != "AfterAll") hbe->beforeEach();
-                }
-                t.fn();
-                if (auto* haa = as<HasAfterEach>(parent)) {
-                    if (t.name != "BeforeAll" && t.name != "AfterAll") haa->afterEach();
-                }
-            });
+    // Returns the frequency scaling governor of the CPUs (e.g. "performance" or "powersave"),
+    // or an empty string if there is none.
+    string cpuGovernor() {
+        ifstream strm("/sys/devices/system/cpu/cpu0/cpufreq/scaling_governor");
+        string governor;
+        getline(strm, governor);
+        return governor;
+    }
+
+    // Returns the 1, 5 and 15 minute load averages of the machine, or an empty string if
+    // they cannot be determined.
+    string loadAverage() {
+        double loads[3];
+        if (getloadavg(loads, 3) != 3) {
+            return "";
         }
-        catch (const SkipTestCase&) {
-            t.skipped = true;
-            if (isVerboseMode) {
-                cout << "SKIPPED";
-            }
+        ostringstream strm;
+        strm << fixed << setprecision(2) << loads[0] << " " << loads[1] << " " << loads[2];
+        return strm.str();
+    }
+}
+
+
+// MARK: Tracing
+
+namespace {
+
+    // Records a timeline of the test run for --trace, written in the Chrome trace event
+    // format so that it can be viewed in Perfetto (or chrome://tracing). Each thread that
+    // runs tests gets its own track, and the number of running suites and the resident
+    // set size are recorded as counters.
+    class Tracer {
+    public:
+        bool isEnabled() const noexcept {
+            return enabled;
         }
-        catch (const exception& e) {
-            if (isVerboseMode) {
-                cout << "E";
-            }
-            t.errors.push_back(TestError::makeError(e));
+
+        // Start recording, with the calling thread shown as the main thread.
+        void start() {
+            origin = steady_clock::now();
+            threadIds[this_thread::get_id()] = 0;
+            enabled = true;
+            sampler = thread([this]{ sampleCounters(); });
         }
-        catch (...) {
-            if (isVerboseMode) {
-                cout << "E";
+
+        // Stop recording, the events remaining available to write.
+        void stop() {
+            if (sampler.joinable()) {
+                {
+                    lock_guard<mutex> l(lock);
+                    stopSampling = true;
+                }
+                samplerCv.notify_all();
+                sampler.join();
             }
-            TestError err;
-            err.errorMessage = "Unknown exception";
-            t.errors.push_back(err);
+            enabled = false;
         }
 
-        // Update the counters.
-        currentTest = nullptr;
-        currentSuite->numberOfErrors += t.errors.size();
-        currentSuite->numberOfFailedAssertions += t.failures.size();
-        if (!t.failures.empty()) ++currentSuite->numberOfFailedTests;
-        if (t.skipped) ++currentSuite->numberOfSkippedTests;
-
+        void addSpan(const string& name, const char* category,
+                     steady_clock::time_point start, steady_clock::time_point end)
         {
-            lock_guard<mutex> l(reportSummary.lock);
-            reportSummary.numberOfErrors += t.errors.size();
-            reportSummary.numberOfFailures += t.failures.size();
-            reportSummary.numberOfAssertions += t.assertions;
-            ++reportSummary.numberOfTests;
+            const auto ts = microseconds(start);
+            const auto dur = microseconds(end) - ts;
+            lock_guard<mutex> l(lock);
+            events.push_back(Event { name, category, 'X', threadId(), ts, dur });
         }
-    }
 
-    // Returns the test suite result as one of the following:
-    // '.' - all tests ran without problem
-    // 'S' - one or more tests were skipped
-    // 'E' - one or more tests caused an error condition
-    // 'F' - one or more tests failed.
-    char result() const noexcept {
-        char res = '.';
-        for (const auto& t : tests) {
-            if (!t.errors.empty()) {
-                res = 'E';
-            }
-            else if (!t.failures.empty()) {
-                if (res != 'E') {
-                    res = 'F';
+        void suiteStarted() {
+            addCounter("running suites", double(++numberOfRunningSuites));
+        }
+
+        void suiteFinished() {
+            addCounter("running suites", double(--numberOfRunningSuites));
+        }
+
+        void write(const string& filename) {
+            write_file_atomically(filename, [&](ofstream& strm) {
+                strm << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [" << endl;
+                for (const auto& [id, tid] : threadIds) {
+                    strm << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << tid
+                        << ", \"args\": {\"name\": \"" << (tid == 0 ? string("main") : "worker " + to_string(tid))
+                        << "\"}}," << endl;
                 }
-            }
-            else if (t.skipped) {
-                if (res == '.') {
-                    res = 'S';
+                strm << fixed << setprecision(3);
+                for (size_t i = 0; i < events.size(); ++i) {
+                    const auto& e = events[i];
+                    strm << "{\"name\": " << quoted(e.name) << ", \"ph\": \"" << e.phase
+                        << "\", \"pid\": 1, \"tid\": " << e.tid << ", \"ts\": " << e.timestamp;
+                    if (e.phase == 'C') {
+                        strm << ", \"args\": {\"value\": " << e.value << "}}";
+                    }
+                    else {
+                        strm << ", \"dur\": " << e.value << ", \"cat\": \"" << e.category << "\"}";
+                    }
+                    strm << (i + 1 < events.size() ? "," : "") << endl;
                 }
-            }
+                strm << "]}" << endl;
+            });
         }
-        return res;
-    }
 
-    // Returns the number of failures (KSS_ASSERT failing) in all the test cases
-    // for the suite.
-    int numberOfFailures() const noexcept {
-        int total = 0;
-        for (const auto& t : tests) {
-            total += t.failures.size();
+    private:
+        struct Event {
+            string      name;
+            const char* category;
+            char        phase;          // 'X' for a span, 'C' for a counter.
+            unsigned    tid;
+            double      timestamp;      // Microseconds since the start of the trace.
+            double      value;          // The duration of a span or the value of a counter.
+        };
+
+        static constexpr auto   counterSamplingInterval = 10ms;
+
+        atomic<bool>                enabled { false };
+        steady_clock::time_point    origin;
+        mutex                       lock;
+        vector<Event>               events;         // Guarded by lock.
+        map<thread::id, unsigned>   threadIds;      // Guarded by lock.
+        atomic<int>                 numberOfRunningSuites { 0 };
+        thread                      sampler;
+        condition_variable          samplerCv;
+        bool                        stopSampling = false;   // Guarded by lock.
+
+        double microseconds(steady_clock::time_point t) const noexcept {
+            return duration<double, micro>(t - origin).count();
         }
-        return total;
-    }
-};
 
+        // Must be called with the lock held.
+        unsigned threadId() {
+            return threadIds.emplace(this_thread::get_id(), unsigned(threadIds.size())).first->second;
+        }
 
-// MARK: Test reporting
+        void addCounter(const char* name, double value) {
+            const auto ts = microseconds(steady_clock::now());
+            lock_guard<mutex> l(lock);
+            events.push_back(Event { name, "", 'C', 0, ts, value });
+        }
 
-namespace {
-    void printTestRunHeader() {
-        if (!isQuietMode) {
-            cout << "Running test suites for " << reportSummary.nameOfTestRun << "..." << endl;;
-            if (!isVerboseMode) {
-                cout << "  ";
-                flush(cout);    // Need flush before we start any threads.
+        // Returns s as a quoted JSON string.
+        static string quoted(const string& s) {
+            ostringstream o;
+            o << '"';
+            for (const auto ch : s) {
+                if (ch == '"' || ch == '\\') { o << '\\' << ch; }
+                else if ((unsigned char)ch < 0x20) { o << "\\u" << hex << setw(4) << setfill('0') << int(ch) << dec; }
+                else { o << ch; }
             }
+            o << '"';
+            return o.str();
         }
-    }
 
-    void outputStandardSummary() {
-        if (!isQuietMode) {
-            if (isParallel) {
-                flush(cout);    // Ensure all the thread output is flushed.
-            }
-            if (!isVerboseMode) {
-                cout << endl;
+        void sampleCounters() {
+            unique_lock<mutex> l(lock);
+            while (!stopSampling) {
+                l.unlock();
+                addCounter("RSS (MB)", double(residentSetSize()) / (1024 * 1024));
+                l.lock();
+                samplerCv.wait_for(l, counterSamplingInterval);
             }
+        }
+    };
 
-            const auto* suites = testSuites();
-            const auto numberOfTestSuites = suites->size();
-            unsigned numberOfErrors = 0, numberOfFailures = 0, numberOfSkips = 0, numberPassed = 0;
-            unsigned numberFilteredOut = 0;
-            for (const auto& ts : *suites) {
-                if (ts.filteredOut) {
-                    ++numberFilteredOut;
-                }
+    // This is never destroyed since a test case (e.g. in a death test) may call exit
+    // while the sampling thread is running.
+    static Tracer& tracer = *new Tracer();
 
-                switch (ts.suite->_implementation()->result()) {
-                    case '.':    ++numberPassed; break;
-                    case 'S':    ++numberOfSkips; break;
-                    case 'E':    ++numberOfErrors; break;
-                    case 'F':    ++numberOfFailures; break;
-                }
+    // Records the time from its construction until its destruction as a span in the
+    // trace. Nothing is recorded when --trace was not given.
+    class TraceSpan {
+    public:
+        TraceSpan(const string& name, const char* category) {
+            if (tracer.isEnabled()) {
+                _name = name;
+                _category = category;
+                _start = steady_clock::now();
             }
+        }
 
-            if (!numberOfFailures && !numberOfErrors && !numberOfSkips) {
-                cout << "  PASSED all " << (numberOfTestSuites-numberFilteredOut) << " test suites.";
+        ~TraceSpan() {
+            if (_category) {
+                tracer.addSpan(_name, _category, _start, steady_clock::now());
             }
-            else {
-                cout << "  Passed " << numberPassed << " of " << (numberOfTestSuites-numberFilteredOut) << " test suites";
-                if (numberOfSkips > 0) {
-                    cout << ", " << numberOfSkips << " skipped";
-                }
-                if (numberOfErrors > 0) {
-                    cout << ", " << numberOfErrors << (numberOfErrors == 1 ? " error" : " errors");
-                }
-                if (numberOfFailures > 0) {
-                    cout << ", " << numberOfFailures << " failed";
-                }
-                cout << ".";
+        }
+
+        TraceSpan(const TraceSpan&) = delete;
+        TraceSpan& operator=(const TraceSpan&) = delete;
+
+    private:
+        string                      _name;
+        const char*                 _category = nullptr;
+        steady_clock::time_point    _start;
+    };
+}
+
+
+// MARK: Performance Counters
+
+namespace {
+
+    using counters_t = map<string, uint64_t>;
+
+    // The counters for --perf-counters, which count the events of the calling thread
+    // only. On Linux they come from perf_event_open, using the hardware counters if the
+    // machine provides them and otherwise (as is common in containers and virtual
+    // machines) falling back to software ones. Elsewhere there are none.
+    class PerformanceCounters {
+    public:
+        PerformanceCounters(const PerformanceCounters&) = delete;
+        PerformanceCounters& operator=(const PerformanceCounters&) = delete;
+
+        // Returns the counters of the calling thread, opening them on first use.
+        static PerformanceCounters& forThisThread() {
+            thread_local PerformanceCounters counters;
+            return counters;
+        }
+
+        // Run fn, returning the counts of the events it caused.
+        counters_t measure(const function<void()>& fn) const {
+            const auto before = read();
+            fn();
+            const auto after = read();
+            counters_t counts;
+            for (size_t i = 0; i < names.size() && i < before.size() && i < after.size(); ++i) {
+                counts[names[i]] = (after[i] > before[i] ? after[i] - before[i] : 0);
             }
+            return counts;
+        }
 
-            if (numberFilteredOut > 0) {
-                cout << "  (" << numberFilteredOut << " filtered out)";
+    private:
+        int             leader = -1;
+        vector<int>     fds;
+        vector<string>  names;
+
+#if defined(__linux__)
+        PerformanceCounters() {
+            if (!openGroup(PERF_TYPE_HARDWARE, {
+                    make_pair(PERF_COUNT_HW_CPU_CYCLES, "cycles"),
+                    make_pair(PERF_COUNT_HW_INSTRUCTIONS, "instructions"),
+                    make_pair(PERF_COUNT_HW_CACHE_MISSES, "cacheMisses"),
+                    make_pair(PERF_COUNT_HW_BRANCH_MISSES, "branchMisses") }))
+            {
+                (void) openGroup(PERF_TYPE_SOFTWARE, {
+                    make_pair(PERF_COUNT_SW_TASK_CLOCK, "taskClockNs"),
+                    make_pair(PERF_COUNT_SW_PAGE_FAULTS, "pageFaults") });
             }
-            cout << endl;
+        }
 
-            if (!isVerboseMode) {
-                // If we are not verbose we need to identify the errors and failures. If
-                // we are verbose, then that information was displayed earlier.
-                if (numberOfErrors > 0) {
-                    cout << "  Errors:" << endl;
-                    for (const auto& ts : *suites) {
-                        for (const auto& t : ts.suite->_implementation()->tests) {
-                            for (const auto& err : t.errors) {
-                                cout << "    " << string(err) << endl;
-                            }
-                        }
+        ~PerformanceCounters() noexcept {
+            for (auto fd : fds) {
+                ::close(fd);
+            }
+        }
+
+        // Open the events as a group, so that they are scheduled together, returning
+        // false if the first of them (the leader) is not available. Other events that
+        // are not available are left out.
+        bool openGroup(uint32_t type, initializer_list<pair<uint64_t, const char*>> events) {
+            for (const auto& [config, name] : events) {
+                perf_event_attr attr;
+                memset(&attr, 0, sizeof(attr));
+                attr.size = sizeof(attr);
+                attr.type = type;
+                attr.config = config;
+                attr.exclude_kernel = 1;
+                attr.exclude_hv = 1;
+                attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+                const int fd = int(syscall(SYS_perf_event_open, &attr, 0, -1, leader, PERF_FLAG_FD_CLOEXEC));
+                if (fd == -1) {
+                    if (leader == -1) {
+                        return false;
                     }
+                    continue;
                 }
-                if (numberOfFailures > 0) {
-                    cout << "  Failures:" << endl;
-                    for (const auto& ts : *suites) {
-                        for (const auto& t : ts.suite->_implementation()->tests) {
-                            for (const auto& f : t.failures) {
-                                cout << "    " << f.first << endl;
-                                if (!f.second.empty()) {
-                                    cout << "       ↳" << f.second << endl;
-                                }
-                            }
-                        }
+                if (leader == -1) {
+                    leader = fd;
+                }
+                fds.push_back(fd);
+                names.push_back(name);
+            }
+            return true;
+        }
+
+        // Returns the current values, scaled up if the kernel had to multiplex them.
+        vector<uint64_t> read() const {
+            vector<uint64_t> values;
+            if (leader != -1) {
+                vector<uint64_t> buffer(3 + names.size());
+                const auto n = ::read(leader, buffer.data(), buffer.size() * sizeof(uint64_t));
+                if (n >= ssize_t(3 * sizeof(uint64_t))) {
+                    const auto enabled = buffer[1], running = buffer[2];
+                    for (size_t i = 0; i < buffer[0] && i < names.size(); ++i) {
+                        const auto value = buffer[3 + i];
+                        values.push_back(running > 0 && running < enabled
+                                         ? uint64_t(double(value) * double(enabled) / double(running))
+                                         : value);
                     }
                 }
             }
+            return values;
+        }
+#else
+        PerformanceCounters() = default;
 
-            cout << "  Completed in " << reportSummary.durationOfTestRun.count() << "s." << endl;
+        vector<uint64_t> read() const {
+            return vector<uint64_t>();
+        }
+#endif
+    };
+
+    // Returns the number of user space instructions executed by the calling thread while
+    // running fn, or nullopt if there is no instruction counter.
+    optional<uint64_t> countInstructions(const function<void()>& fn) {
+#if defined(__linux__)
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        const int fd = int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC));
+        if (fd == -1) {
+            return nullopt;
+        }
+        finally cleanup([&]{ ::close(fd); });
+
+        (void) ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        (void) ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        fn();
+        (void) ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        uint64_t count = 0;
+        if (::read(fd, &count, sizeof(count)) != ssize_t(sizeof(count))) {
+            return nullopt;
         }
+        return count;
+#else
+        (void) fn;
+        return nullopt;
+#endif
     }
+}
 
-    template <class T, class Node>
-    struct AbstractGenerator {
-        virtual ~AbstractGenerator() = default;
-        AbstractGenerator(const AbstractGenerator&) = default;
-        AbstractGenerator(AbstractGenerator&&) = default;
-        AbstractGenerator& operator=(const AbstractGenerator&) = default;
-        AbstractGenerator& operator=(AbstractGenerator&&) = default;
 
-        Node* operator()() {
-            if (_it == _items.end()) {
-                return nullptr;
+// MARK: Profiling
+
+namespace {
+
+    // A sampling profiler for --profile. Every sampling interval of CPU time the process
+    // receives SIGPROF (from setitimer), which is handled by whichever thread was using
+    // the CPU. The handler records that thread's stack along with the test case it was
+    // running. Once the run is over the samples are written, one file per test suite,
+    // as folded stacks that flame graph tools (e.g. flamegraph.pl or speedscope) read.
+    class Profiler {
+    public:
+        void start() {
+            samples.reset(new Sample[maxNumberOfSamples]);
+            numberOfSamples = 0;
+
+            // The first call of backtrace may allocate memory, which must not happen in
+            // the signal handler.
+            void* frames[1];
+            (void) backtrace(frames, 1);
+
+            activeProfiler = this;
+            struct sigaction sa;
+            memset(&sa, 0, sizeof(sa));
+            sa.sa_handler = handleSignal;
+            sa.sa_flags = SA_RESTART;
+            sigemptyset(&sa.sa_mask);
+            if (sigaction(SIGPROF, &sa, &previousAction) == -1) {
+                throw system_error(errno, system_category(), "Failed to install the SIGPROF handler");
             }
-            else {
-                _n.clear();
-                populate();
-                ++_it;
-                return &_n;
+
+            struct itimerval timer;
+            timer.it_interval.tv_sec = 0;
+            timer.it_interval.tv_usec = samplingIntervalMicroseconds;
+            timer.it_value = timer.it_interval;
+            if (setitimer(ITIMER_PROF, &timer, nullptr) == -1) {
+                throw system_error(errno, system_category(), "Failed to start the profiling timer");
             }
+            isRunning = true;
         }
 
-        virtual void populate() = 0;
-
-    protected:
-        AbstractGenerator(const vector<T>& items) : _items(items) {
-            _it = _items.begin();
+        void stop() noexcept {
+            if (isRunning) {
+                struct itimerval timer;
+                memset(&timer, 0, sizeof(timer));
+                (void) setitimer(ITIMER_PROF, &timer, nullptr);
+
+                // A SIGPROF may already be pending, and with the default action it would
+                // kill the process. Ignoring the signal discards any pending one, and
+                // with the timer stopped no more can arrive, so only then is it safe to
+                // restore the previous action.
+                activeProfiler = nullptr;
+                struct sigaction sa;
+                memset(&sa, 0, sizeof(sa));
+                sa.sa_handler = SIG_IGN;
+                sigemptyset(&sa.sa_mask);
+                (void) sigaction(SIGPROF, &sa, nullptr);
+                (void) sigaction(SIGPROF, &previousAction, nullptr);
+                isRunning = false;
+            }
         }
-        const vector<T>&                    _items;
-        typename vector<T>::const_iterator  _it;
-        Node                                _n;
-    };
 
-    struct FailureXmlGenerator
-    : public AbstractGenerator<pair<string, string>, xml::simple_writer::node>
-    {
-        FailureXmlGenerator(const failures_t& failures) : AbstractGenerator(failures) {}
-        virtual ~FailureXmlGenerator() = default;
+        // Write the folded stacks of each suite to "<directory>/<suite name>.folded", with the
+        // name escaped so that suites whose names differ only in punctuation get their own files.
+        void write(const string& directory) {
+            const auto n = min(numberOfSamples.load(), maxNumberOfSamples);
+            map<const TestSuiteWrapper*, map<string, unsigned>> stacksBySuite;
+            for (size_t i = 0; i < n; ++i) {
+                const auto& sample = samples[i];
+                string stack = sanitize(sample.test->name);
+                for (auto frame = sample.depth - 1; frame >= framesToSkip; --frame) {
+                    stack += ';';
+                    stack += symbolFor(sample.frames[frame]);
+                }
+                ++stacksBySuite[sample.suite][stack];
+            }
 
-        virtual void populate() override {
-            _n.name = "failure";
-            _n["message"] = _it->first;
-            if (!_it->second.empty()) {
-                _n.text = _it->second;
+            for (const auto& [suite, stacks] : stacksBySuite) {
+                const auto filename = (path(directory) / (fileSafeEscaped(suite->suite->name()) + ".folded")).string();
+                write_file_atomically(filename, [&](ofstream& strm) {
+                    for (const auto& [stack, count] : stacks) {
+                        strm << stack << ' ' << count << endl;
+                    }
+                });
+            }
+
+            if (numberOfSamples > maxNumberOfSamples) {
+                cerr << "Warning: --profile ran out of space, "
+                    << (numberOfSamples - maxNumberOfSamples) << " samples were dropped." << endl;
+            }
+        }
+
+    private:
+        static constexpr int        maxDepth = 48;
+        static constexpr int        framesToSkip = 2;   // The handler and the signal trampoline.
+        static constexpr size_t     maxNumberOfSamples = 1 << 16;
+        static constexpr long       samplingIntervalMicroseconds = 1000;
+
+        struct Sample {
+            const TestSuiteWrapper* suite;
+            const TestCaseWrapper*  test;
+            int                     depth;
+            void*                   frames[maxDepth];
+        };
+
+        static Profiler*            activeProfiler;
+
+        unique_ptr<Sample[]>        samples;
+        atomic<size_t>              numberOfSamples { 0 };
+        bool                        isRunning = false;
+        struct sigaction            previousAction;
+        map<void*, string>          symbols;
+
+        // This must only do what is async-signal-safe, hence the preallocated samples.
+        static void handleSignal(int) {
+            const auto savedErrno = errno;
+            auto* p = activeProfiler;
+            const TestCaseWrapper* test = currentTest;
+            const TestSuiteWrapper* suite = currentSuite;
+            if (test && test->original) {
+                test = test->original;      // An iteration or retry, which will not last.
+            }
+            if (p && test && suite) {
+                const auto i = p->numberOfSamples.fetch_add(1, memory_order_relaxed);
+                if (i < maxNumberOfSamples) {
+                    auto& sample = p->samples[i];
+                    sample.suite = suite;
+                    sample.test = test;
+                    sample.depth = backtrace(sample.frames, maxDepth);
+                }
+            }
+            errno = savedErrno;
+        }
+
+        const string& symbolFor(void* address) {
+            auto it = symbols.find(address);
+            if (it == symbols.end()) {
+                string name;
+                Dl_info info;
+                const bool isFound = (dladdr(address, &info) != 0);
+                if (isFound && info.dli_sname) {
+                    int status = 0;
+                    char* demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+                    name = (status == 0 && demangled ? demangled : info.dli_sname);
+                    free(demangled);
+                }
+                else if (isFound && info.dli_fname) {
+                    // Without a symbol we give the module and offset, for use with addr2line.
+                    ostringstream strm;
+                    strm << path(info.dli_fname).filename().string() << "+0x" << hex
+                        << (uintptr_t(address) - uintptr_t(info.dli_fbase));
+                    name = strm.str();
+                }
+                else {
+                    ostringstream strm;
+                    strm << address;
+                    name = strm.str();
+                }
+                it = symbols.emplace(address, sanitize(name)).first;
             }
+            return it->second;
+        }
+
+        // The folded format separates the frames with ';' and ends with " count".
+        static string sanitize(string name) {
+            replace(name.begin(), name.end(), ';', ':');
+            replace(name.begin(), name.end(), '\n', ' ');
+            return name;
         }
     };
 
-    struct ErrorXmlGenerator : public AbstractGenerator<TestError, xml::simple_writer::node> {
-        ErrorXmlGenerator(const vector<TestError>& errors) : AbstractGenerator(errors) {}
-        virtual ~ErrorXmlGenerator() = default;
+    Profiler* Profiler::activeProfiler = nullptr;
+}
 
-        virtual void populate() override {
-            _n.name = "error";
-            _n["message"] = _it->errorMessage;
-            if (!_it->errorType.empty()) _n["type"] = _it->errorType;
+
+// MARK: Reporter Pipeline
+
+namespace {
+
+    // A lock-free queue for many producers and a single consumer, after Dmitry Vyukov's
+    // MPSC node queue. A producer links its node in with a single exchange of the head,
+    // and the consumer follows the links from the tail. A push that is still in progress
+    // is not seen by pop until it has completed.
+    template <class T>
+    class MpscQueue {
+    public:
+        MpscQueue() = default;
+        MpscQueue(const MpscQueue&) = delete;
+        MpscQueue& operator=(const MpscQueue&) = delete;
+
+        ~MpscQueue() noexcept {
+            T value;
+            while (pop(value)) {}
+            if (_tail != &_stub) {
+                delete _tail;
+            }
+        }
+
+        // May be called from any thread.
+        void push(T&& value) {
+            auto* n = new Node();
+            n->value = move(value);
+            auto* previous = _head.exchange(n, memory_order_acq_rel);
+            previous->next.store(n, memory_order_release);
+        }
+
+        // Must only be called from the consuming thread.
+        bool pop(T& value) {
+            auto* next = _tail->next.load(memory_order_acquire);
+            if (!next) {
+                return false;
+            }
+            value = move(next->value);
+            if (_tail != &_stub) {
+                delete _tail;
+            }
+            _tail = next;       // Which becomes the new (empty) stub.
+            return true;
         }
+
+    private:
+        struct Node {
+            atomic<Node*>   next { nullptr };
+            T               value;
+        };
+
+        Node            _stub;
+        atomic<Node*>   _head { &_stub };
+        Node*           _tail = &_stub;
     };
 
-    struct TestCaseXmlGenerator : public AbstractGenerator<TestCaseWrapper, xml::simple_writer::node> {
-        TestCaseXmlGenerator(const vector<TestCaseWrapper>& testCases) : AbstractGenerator(testCases) {}
-        virtual ~TestCaseXmlGenerator() = default;
+    // Passes the events of the test run from the threads running the tests to the
+    // reporters, which are all called from a dedicated reporter thread.
+    class ReporterPipeline {
+    public:
+        void add(shared_ptr<Reporter> reporter) {
+            reporters.push_back(move(reporter));
+        }
 
-        virtual void populate() override {
-            _n.name = "testcase";
-            _n["name"] = _it->name;
-            _n["assertions"] = to_string(_it->assertions);
-            _n["classname"] = (_it->owner ? _private::demangle(*(_it->owner)) : string("none"));
-            _n["time"] = to_string(_it->durationOfTest.count());
-            if (!_it->errors.empty() || !_it->failures.empty()) {
-                _n.children = {
-                    ErrorXmlGenerator(_it->errors),
-                    FailureXmlGenerator(_it->failures)
-                };
+        // Start the reporter thread, if there are any reporters.
+        void start() {
+            if (!reporters.empty()) {
+                stopping = false;
+                consumer = thread([this]{ consume(); });
+                active = true;
+            }
+        }
+
+        // Stop the reporter thread once it has delivered all the events posted so far.
+        void stop() {
+            if (consumer.joinable()) {
+                {
+                    lock_guard<mutex> l(lock);
+                    stopping = true;
+                }
+                wakeup.notify_one();
+                consumer.join();
+            }
+            active = false;
+        }
+
+        // Returns the first exception thrown by a reporter, if there was one.
+        exception_ptr exception() const noexcept {
+            return firstException;
+        }
+
+        // This is called from the failure paths, which may not throw, so an event that
+        // cannot be allocated is dropped rather than reported.
+        void post(Reporter::Event::Kind kind, const string& suite, const string& testCase = string(),
+                  const string& message = string(), Reporter::Status status = Reporter::Status::Passed,
+                  duration<double> d = duration<double>::zero()) noexcept
+        {
+            if (active) {
+                try {
+                    Reporter::Event e;
+                    e.kind = kind;
+                    e.suite = suite;
+                    e.testCase = testCase;
+                    e.message = message;
+                    e.status = status;
+                    e.duration = d;
+                    queue.push(move(e));
+                }
+                catch (...) {
+                    return;
+                }
+
+                // Notifying without the lock means that the consumer may miss this, in
+                // which case its timeout limits the delay.
+                wakeup.notify_one();
+            }
+        }
+
+    private:
+        static constexpr auto           pollInterval = 10ms;
+
+        vector<shared_ptr<Reporter>>    reporters;
+        MpscQueue<Reporter::Event>      queue;
+        atomic<bool>                    active { false };
+        thread                          consumer;
+        mutex                           lock;
+        condition_variable              wakeup;
+        bool                            stopping = false;   // Guarded by lock.
+        exception_ptr                   firstException;     // Only used by the consumer.
+
+        void consume() {
+            Reporter::Event e;
+            unique_lock<mutex> l(lock);
+            while (true) {
+                // Everything posted before stop() was called is in the queue by the time
+                // stopping is seen, so one more pass will deliver it.
+                const bool isLastPass = stopping;
+                l.unlock();
+                while (queue.pop(e)) {
+                    deliver(e);
+                }
+                l.lock();
+                if (isLastPass) {
+                    break;
+                }
+                wakeup.wait_for(l, pollInterval);
+            }
+        }
+
+        void deliver(const Reporter::Event& e) noexcept {
+            for (auto& r : reporters) {
+                try {
+                    r->report(e);
+                }
+                catch (...) {
+                    if (!firstException) {
+                        firstException = current_exception();
+                    }
+                }
             }
         }
     };
 
-    struct TestSuiteXmlGenerator : public AbstractGenerator<TestSuiteWrapper, xml::simple_writer::node> {
-        TestSuiteXmlGenerator(const vector<TestSuiteWrapper>& suites) : AbstractGenerator(suites) {}
-        virtual ~TestSuiteXmlGenerator() = default;
+    // Lazy instantiation, since reporters may be added by static initializers. It is
+    // never destroyed since a test case (e.g. in a death test) may call exit while the
+    // reporter thread is running.
+    ReporterPipeline& reporterPipeline() {
+        static auto* pipeline = new ReporterPipeline();
+        return *pipeline;
+    }
 
-        virtual void populate() override {
-            _n.name = "testsuite";
-            _n["name"] = _it->suite->name();
-            _n["tests"] = to_string(_it->suite->_implementation()->tests.size());
-            _n["errors"] = to_string(_it->numberOfErrors);
-            _n["failures"] = to_string(_it->numberOfFailedAssertions);
-            _n["hostname"] = reportSummary.nameOfHost;
-            _n["id"] = to_string(id++);
-            _n["skipped"] = to_string(_it->numberOfSkippedTests);
-            _n["time"] = to_string(_it->durationOfTestSuite.count());
-            _n["timestamp"] = _it->timestamp;
-            _n.children = { TestCaseXmlGenerator(_it->suite->_implementation()->tests) };
+    // The character shown for a test suite with the given status.
+    char resultCharacter(Reporter::Status status) noexcept {
+        switch (status) {
+            case Reporter::Status::Passed:  return '.';
+            case Reporter::Status::Skipped: return 'S';
+            case Reporter::Status::Error:   return 'E';
+            case Reporter::Status::Failed:  return 'F';
+        }
+        return '?';
+    }
+
+    Reporter::Status statusFromResultCharacter(char result) noexcept {
+        switch (result) {
+            case 'S':   return Reporter::Status::Skipped;
+            case 'E':   return Reporter::Status::Error;
+            case 'F':   return Reporter::Status::Failed;
+            default:    return Reporter::Status::Passed;
+        }
+    }
+
+    // Writes the result character of each test suite as it finishes, which is the
+    // progress shown in the normal (neither quiet nor verbose) mode.
+    class ProgressReporter : public Reporter {
+    public:
+        void report(const Event& event) override {
+            if (event.kind == Event::Kind::SuiteFinished) {
+                cout << resultCharacter(event.status);
+            }
+        }
+    };
+
+    // Streams the results of the test cases in the Test Anything Protocol (version 13)
+    // as they finish. Since the suites may run in parallel, each test point is named by
+    // both its suite and test case, and the plan is written at the end.
+    class TapReporter : public Reporter {
+    public:
+        explicit TapReporter(const string& filename) : filename(filename) {
+            if (filename != "-") {
+                errno = 0;
+                file.open(filename);
+                if (!file.is_open()) { throwProcessingError(filename, "Failed to open"); }
+            }
+        }
+
+        void report(const Event& event) override {
+            auto& strm = (filename == "-" ? cout : file);
+            switch (event.kind) {
+                case Event::Kind::RunStarted:
+                    strm << "TAP version 13" << endl;
+                    break;
+                case Event::Kind::AssertionFailed:
+                    failures[make_pair(event.suite, event.testCase)].push_back(event.message);
+                    break;
+                case Event::Kind::CaseFinished:
+                    writeTestPoint(strm, event);
+                    break;
+                case Event::Kind::RunFinished:
+                    strm << "1.." << numberOfTestPoints << endl;
+                    if (!strm) { throwProcessingError(filename, "Failed while writing"); }
+                    break;
+                default:
+                    break;
+            }
         }
 
     private:
-        int id = 0;
+        string                                          filename;
+        ofstream                                        file;
+        unsigned                                        numberOfTestPoints = 0;
+        map<pair<string, string>, vector<string>>       failures;   // Until the case finishes.
+
+        void writeTestPoint(ostream& strm, const Event& event) {
+            const auto key = make_pair(event.suite, event.testCase);
+            const auto ok = (event.status == Status::Passed || event.status == Status::Skipped);
+            strm << (ok ? "ok " : "not ok ") << ++numberOfTestPoints << " - "
+                << event.suite << ": " << event.testCase;
+            if (event.status == Status::Skipped) {
+                strm << " # SKIP";
+            }
+            strm << endl;
+
+            if (!ok) {
+                strm << "  ---" << endl;
+                if (!event.message.empty()) {
+                    strm << "  error: " << yamlString(event.message) << endl;
+                }
+                if (const auto it = failures.find(key); it != failures.end()) {
+                    strm << "  failures:" << endl;
+                    for (const auto& f : it->second) {
+                        strm << "    - " << yamlString(f) << endl;
+                    }
+                }
+                strm << "  ..." << endl;
+            }
+            failures.erase(key);
+        }
+
+        // A double quoted YAML scalar, with the control characters (which would otherwise
+        // break the document or be dropped by the reader) escaped.
+        static string yamlString(const string& s) {
+            static constexpr char hexDigits[] = "0123456789ABCDEF";
+            string quoted = "\"";
+            for (const auto ch : s) {
+                const auto uch = (unsigned char)ch;
+                switch (ch) {
+                    case '"':  quoted += "\\\""; break;
+                    case '\\': quoted += "\\\\"; break;
+                    case '\n': quoted += "\\n"; break;
+                    case '\r': quoted += "\\r"; break;
+                    case '\t': quoted += "\\t"; break;
+                    default:
+                        if (uch < 0x20 || uch == 0x7f) {
+                            quoted += "\\x";
+                            quoted += hexDigits[uch >> 4];
+                            quoted += hexDigits[uch & 0xf];
+                        }
+                        else {
+                            quoted += ch;
+                        }
+                        break;
+                }
+            }
+            return quoted + "\"";
+        }
     };
 
-    void writeXmlReportToStream(ostream& strm) {
-        xml::simple_writer::node root;
-        root.name = "testsuites";
-        root["errors"] = to_string(reportSummary.numberOfErrors);
-        root["failures"] = to_string(reportSummary.numberOfFailures);
-        root["name"] = reportSummary.nameOfTestRun;
-        root["tests"] = to_string(reportSummary.numberOfAssertions - reportSummary.numberOfFailures);
-        root["time"] = to_string(reportSummary.durationOfTestRun.count());
-        const auto* suites = testSuites();
-        root.children = { TestSuiteXmlGenerator(*suites) };
-        xml::simple_writer::write(strm, root);
+    Reporter::Status statusOf(const TestCaseWrapper& t) noexcept {
+        if (!t.errors.empty()) { return Reporter::Status::Error; }
+        if (!t.failures.empty()) { return Reporter::Status::Failed; }
+        if (t.skipped) { return Reporter::Status::Skipped; }
+        return Reporter::Status::Passed;
     }
 
-    void printXmlReport() {
-        if (xmlReportFilename == "-") {
-            if (!isQuietMode || jsonReportFilename == "-") {
-                cout << "==XML=REPORT===================================" << endl;
+    void postTestCaseFinished(const TestCaseWrapper& t) {
+        reporterPipeline().post(Reporter::Event::Kind::CaseFinished, t.suiteWrapper->suite->name(), t.name,
+                              t.errors.empty() ? string() : string(t.errors.front()),
+                              statusOf(t), t.durationOfTest);
+    }
+
+    // Submit a task that only idle threads take, and once it is no longer needed, take
+    // back those not yet started and wait for the rest. (Defined with the executor.)
+    Executor::task_t submitForIdleThreads(function<void()> fn);
+    void withdrawAndWait(const vector<Executor::task_t>& tasks);
+}
+
+
+// MARK: TestSuite::Impl Implementation
+
+struct TestSuite::Impl {
+    TestSuite*                parent = nullptr;
+    string                    name;
+    vector<TestCaseWrapper>   tests;
+    mutex                     repetitionLock;
+    mutex                     resultsLock;          // Held while recording a test case.
+    vector<TestCaseWrapper*>  testCasesToRetry;
+
+    // Set by suites, such as DataDrivenTestSuite, whose test cases are only created when
+    // the suite is run, and which may be run in parallel with each other.
+    function<void(vector<TestCaseWrapper>&)>  createTestCases;
+    bool                                      mayRunTestCasesInParallel = false;
+
+    // Add the BeforeAll and AfterAll "tests" if appropriate.
+    void addBeforeAndAfterAll() {
+        if (auto* hba = as<HasBeforeAll>(parent)) {
+            TestCaseWrapper wrapper;
+            wrapper.name = "BeforeAll";
+            wrapper.isBeforeAll = true;
+            wrapper.owner = parent;
+            wrapper.fn = [hba] { hba->beforeAll(); };
+            tests.insert(tests.begin(), move(wrapper));
+        }
+        if (auto* haa = as<HasAfterAll>(parent)) {
+            TestCaseWrapper wrapper;
+            wrapper.name = "AfterAll";
+            wrapper.isAfterAll = true;
+            wrapper.owner = parent;
+            wrapper.fn = [haa] { haa->afterAll(); };
+            tests.push_back(move(wrapper));
+        }
+    }
+
+    // Remove the test cases that --rerun-failed is not rerunning. If the BeforeAll or
+    // AfterAll failed, the suite is rerun in full since they affect every test case.
+    void removeTestCasesNotToRerun() {
+        const auto it = testCasesToRerun.find(name);
+        if (it == testCasesToRerun.end()) {
+            return;     // Run only as a prerequisite of another suite.
+        }
+        const auto& names = it->second;
+        if (names.count("BeforeAll") || names.count("AfterAll")) {
+            return;
+        }
+        tests.erase(remove_if(tests.begin(), tests.end(), [&](const TestCaseWrapper& t) {
+            return names.count(t.name) == 0;
+        }), tests.end());
+    }
+
+    // Run a test case, leaving the results in t. The results are not added to the totals.
+    void executeTestCase(TestCaseWrapper& t) {
+        auto* previousTest = currentTest;
+        auto* previousSuite = currentSuite;
+        currentTest = &t;
+        currentSuite = t.suiteWrapper;
+        finally restore([&]{
+            currentTest = previousTest;
+            currentSuite = previousSuite;
+        });
+
+        const bool showProgress = (isVerboseMode && !isRepeating());
+        const bool fixture = isFixture(t);
+        TraceSpan span(t.name, fixture ? "fixture" : "case");
+        mostRecentDetails.clear();
+        try {
+            t.durationOfTest = timeOfExecution([&]{
+                if (auto* hbe = as<HasBeforeEach>(parent)) {
+                    if (!fixture) {
+                        TraceSpan span("beforeEach", "fixture");
+                        hbe->beforeEach();
+                    }
+                }
+                t.fn();
+                if (auto* haa = as<HasAfterEach>(parent)) {
+                    if (!fixture) {
+                        TraceSpan span("afterEach", "fixture");
+                        haa->afterEach();
+                    }
+                }
+            });
+        }
+        catch (const SkipTestCase&) {
+            t.skipped = true;
+            if (showProgress) {
+                cout << "SKIPPED";
             }
-            writeXmlReportToStream(cout);
+        }
+        catch (const exception& e) {
+            if (showProgress) {
+                cout << "E";
+            }
+            t.errors.push_back(TestError::makeError(e));
+        }
+        catch (...) {
+            if (showProgress) {
+                cout << "E";
+            }
+            TestError err;
+            err.errorMessage = "Unknown exception";
+            t.errors.push_back(err);
+        }
+    }
+
+    // Add the results of a test case to the totals.
+    void recordTestCase(const TestCaseWrapper& t) {
+        auto* sw = t.suiteWrapper;
+        sw->numberOfErrors += t.errors.size();
+        sw->numberOfFailedAssertions += t.failures.size();
+        if (!t.failures.empty()) ++sw->numberOfFailedTests;
+        if (t.skipped) ++sw->numberOfSkippedTests;
+
+        {
+            lock_guard<mutex> l(reportSummary.lock);
+            reportSummary.numberOfErrors += t.errors.size();
+            reportSummary.numberOfFailures += t.failures.size();
+            reportSummary.numberOfAssertions += t.assertions;
+            ++reportSummary.numberOfTests;
+        }
+
+        postTestCaseFinished(t);
+
+        // Tell everything else to stop if requested.
+        if (stopOnFirstFailure && (!t.errors.empty() || !t.failures.empty())) {
+            isCancelled = true;
+        }
+    }
+
+    // Run a test. If it fails and may be retried, it is not recorded until
+    // retryFailedTestCases has been called.
+    void runTestCase(TestCaseWrapper& t) {
+        t.suiteWrapper = currentSuite;
+        t.seed = runSeed;
+        if (usePerformanceCounters) {
+            t.counters = PerformanceCounters::forThisThread().measure([&]{ executeTestCase(t); });
         }
         else {
-            write_file(xmlReportFilename, [&](ofstream& strm) {
-                writeXmlReportToStream(strm);
-            });
-            if (!isQuietMode) {
-                cout << "  Wrote XML report to " << xmlReportFilename << endl;
+            executeTestCase(t);
+        }
+        lock_guard<mutex> l(resultsLock);
+        if (mayRetry(t)) {
+            testCasesToRetry.push_back(&t);
+        }
+        else {
+            recordTestCase(t);
+        }
+    }
+
+    // Run the test cases spread across the executor. BeforeAll and AfterAll (if there are
+    // any) are run before and after all the others.
+    void runTestCasesInParallel() {
+        auto* wrapper = currentSuite;
+        vector<TestCaseWrapper*> cases;
+        for (auto& t : tests) {
+            if (!isFixture(t)) {
+                cases.push_back(&t);
+            }
+        }
+
+        if (!tests.empty() && tests.front().isBeforeAll) {
+            runTestCase(tests.front());
+        }
+
+        atomic<size_t> nextCase { 0 };
+        auto runCases = [&] {
+            auto* previousSuite = currentSuite;
+            currentSuite = wrapper;
+            while (!isCancelled) {
+                const auto i = nextCase++;
+                if (i >= cases.size()) {
+                    break;
+                }
+                runTestCase(*cases[i]);
+            }
+            currentSuite = previousSuite;
+        };
+
+        // The runners are only taken by idle threads, since a test case of another suite
+        // that is waiting on its own tasks would otherwise be charged for our test cases.
+        // Once we have started the last of them, those not yet taken are not needed.
+        const auto numberOfRunners = min(size_t(executor().concurrency()) + 1, cases.size());
+        vector<Executor::task_t> runners;
+        for (size_t i = 1; i < numberOfRunners; ++i) {
+            runners.push_back(submitForIdleThreads(runCases));
+        }
+        runCases();
+        withdrawAndWait(runners);
+
+        // Once cancelled we stop starting test cases, so those not yet started are skipped.
+        for (auto i = min(size_t(nextCase), cases.size()); i < cases.size(); ++i) {
+            skipTestCase(*cases[i]);
+            postTestCaseFinished(*cases[i]);
+        }
+
+        retryFailedTestCases();
+        if (!tests.empty() && tests.back().isAfterAll) {
+            runTestCase(tests.back());
+        }
+    }
+
+    // Returns true if t has failed but --retries allows it another attempt.
+    bool mayRetry(const TestCaseWrapper& t) const noexcept {
+        return (retryCount > 0 && !isRepeating()
+                && (!t.errors.empty() || !t.failures.empty())
+                && !isFixture(t));
+    }
+
+    // Rerun the test cases that failed, up to --retries times each, stopping at the
+    // first attempt that passes (in which case the test case is flaky). The test cases
+    // are then recorded.
+    void retryFailedTestCases() {
+        for (auto* t : testCasesToRetry) {
+            while (t->retries < retryCount && !isCancelled) {
+                TestCaseWrapper attempt;
+                attempt.original = t;
+                attempt.name = t->name;
+                attempt.owner = t->owner;
+                attempt.suiteWrapper = t->suiteWrapper;
+                attempt.fn = t->fn;
+                attempt.seed = t->seed;
+
+                ++t->retries;
+                if (isVerboseMode) {
+                    cout << "    " << t->name << " (retry " << t->retries << ") ";
+                }
+                executeTestCase(attempt);
+                t->assertions.add(attempt.assertions);
+                t->flaky = (attempt.errors.empty() && attempt.failures.empty());
+                if (isVerboseMode) {
+                    cout << (t->flaky ? " FLAKY" : "") << endl;
+                }
+                if (t->flaky) {
+                    t->skipped = attempt.skipped;
+                    break;
+                }
+                move(attempt.errors.begin(), attempt.errors.end(), back_inserter(t->flakyErrors));
+                move(attempt.failures.begin(), attempt.failures.end(), back_inserter(t->flakyFailures));
+            }
+
+            if (t->flaky) {
+                lock_guard<mutex> l(reportSummary.lock);
+                ++reportSummary.numberOfFlakyTests;
+                t->flakyErrors.insert(t->flakyErrors.begin(), t->errors.begin(), t->errors.end());
+                t->flakyFailures.insert(t->flakyFailures.begin(), t->failures.begin(), t->failures.end());
+                t->errors.clear();
+                t->failures.clear();
+            }
+            else {
+                t->flakyErrors.clear();
+                t->flakyFailures.clear();
+            }
+            recordTestCase(*t);
+        }
+        testCasesToRetry.clear();
+    }
+
+    // Run one iteration of a repeated test case, adding its results to those of t.
+    void runIteration(TestCaseWrapper& t, unsigned iteration) {
+        TestCaseWrapper it;
+        it.original = &t;
+        it.name = t.name;
+        it.owner = t.owner;
+        it.suiteWrapper = t.suiteWrapper;
+        it.fn = t.fn;
+        it.seed = runSeed + iteration;
+        executeTestCase(it);
+
+        const bool failed = (!it.errors.empty() || !it.failures.empty());
+        const auto secs = it.durationOfTest.count();
+        lock_guard<mutex> l(repetitionLock);
+        ++t.iterations;
+        t.assertions.add(it.assertions);
+        t.durationOfTest += it.durationOfTest;
+        t.sumOfSquaredDurations += secs * secs;
+        t.skipped = (t.skipped || it.skipped);
+        if (failed) {
+            ++t.failedIterations;
+            if (t.firstFailedIteration < 0 || long(iteration) < t.firstFailedIteration) {
+                t.firstFailedIteration = long(iteration);
+                t.seed = it.seed;
+                t.errors = move(it.errors);
+                t.failures = move(it.failures);
+            }
+            if (stopOnFirstFailure) {
+                isCancelled = true;
+            }
+        }
+    }
+
+    // Run the test cases repeatedly. Each iteration runs all the test cases (other than
+    // BeforeAll and AfterAll, which are run once) in order, and if the suite allows it
+    // the iterations are spread across the executor.
+    void runTestCasesRepeatedly() {
+        vector<TestCaseWrapper*> cases;
+        for (auto& t : tests) {
+            t.suiteWrapper = currentSuite;
+            t.seed = runSeed;
+            t.durationOfTest = duration<double>::zero();
+            if (!isFixture(t)) {
+                cases.push_back(&t);
+            }
+        }
+
+        if (!tests.empty() && tests.front().isBeforeAll) {
+            runTestCase(tests.front());
+        }
+
+        atomic<unsigned> nextIteration { 0 };
+        auto runIterations = [&] {
+            while (!isCancelled) {
+                const auto iteration = nextIteration++;
+                if (repeatCount > 0 && iteration >= repeatCount) {
+                    break;
+                }
+                for (auto* t : cases) {
+                    if (isCancelled) {
+                        break;
+                    }
+                    runIteration(*t, iteration);
+                }
+            }
+        };
+
+        if (isParallel && as<MayRepeatInParallel>(parent)) {
+            auto& ex = executor();
+            auto numberOfRunners = ex.concurrency() + 1;
+            if (repeatCount > 0) {
+                numberOfRunners = min(numberOfRunners, repeatCount);
+            }
+            vector<Executor::task_t> runners;
+            for (unsigned i = 1; i < numberOfRunners; ++i) {
+                runners.push_back(submitForIdleThreads(runIterations));
+            }
+            runIterations();
+            withdrawAndWait(runners);
+        }
+        else {
+            runIterations();
+        }
+
+        for (auto* t : cases) {
+            if (t->iterations == 0) {
+                t->skipped = true;      // Cancelled before it could run.
+            }
+            if (isVerboseMode) {
+                cout << "    " << t->name << " " << describeRepetitions(*t) << endl;
+            }
+            recordTestCase(*t);
+        }
+
+        if (!tests.empty() && tests.back().isAfterAll) {
+            runTestCase(tests.back());
+        }
+    }
+
+    // Mark a test case as skipped without running it.
+    void skipTestCase(TestCaseWrapper& t) noexcept {
+        t.suiteWrapper = currentSuite;
+        t.skipped = true;
+        ++currentSuite->numberOfSkippedTests;
+    }
+
+    // Returns the test suite result as one of the following:
+    // '.' - all tests ran without problem
+    // 'S' - one or more tests were skipped
+    // 'E' - one or more tests caused an error condition
+    // 'F' - one or more tests failed.
+    char result() const noexcept {
+        char res = '.';
+        for (const auto& t : tests) {
+            if (!t.errors.empty()) {
+                res = 'E';
+            }
+            else if (!t.failures.empty()) {
+                if (res != 'E') {
+                    res = 'F';
+                }
+            }
+            else if (t.skipped) {
+                if (res == '.') {
+                    res = 'S';
+                }
+            }
+        }
+        return res;
+    }
+
+    // Returns the number of failures (KSS_ASSERT failing) in all the test cases
+    // for the suite.
+    int numberOfFailures() const noexcept {
+        int total = 0;
+        for (const auto& t : tests) {
+            total += t.failures.size();
+        }
+        return total;
+    }
+};
+
+
+// MARK: Executor Implementation
+
+class Executor::Task {
+public:
+    function<void()>    fn;
+    void*               context = nullptr;
+    bool                isTestSuite = false;
+    bool                isForIdleThreads = false;   // Queued with the test suites.
+    bool                done = false;           // Guarded by Executor::Impl::lock.
+    exception_ptr       exception;
+};
+
+struct Executor::Impl {
+    mutex               lock;
+    condition_variable  cv;
+    deque<task_t>       tasks;                  // Submitted from within test cases.
+    deque<task_t>       testSuites;             // Submitted by the runner, or for idle threads.
+    unsigned            numberOfWorkers = 0;
+
+    // Time each thread spent running the tasks of test cases while not running a test
+    // suite of its own, such as an idle worker helping with a parallelFor. This is not
+    // part of any suite duration. Guarded by lock.
+    map<thread::id, double> helpingTime;
+
+    // Returns the next task to run, or nullptr if there are none. Test suites are only
+    // taken by idle workers (and the main thread), never by a test case that is waiting
+    // on its own tasks, since that would make the waiting test case appear to take as
+    // long as an entire other test suite. Must be called with the lock held.
+    task_t nextTask(bool includeTestSuites) {
+        task_t t;
+        if (!tasks.empty()) {
+            t = move(tasks.front());
+            tasks.pop_front();
+        }
+        else if (includeTestSuites && !testSuites.empty()) {
+            t = move(testSuites.front());
+            testSuites.pop_front();
+        }
+        return t;
+    }
+
+    // Run a task in the current thread. Must be called without the lock held.
+    void runTask(const task_t& t) {
+        const bool isHelping = (!t->isTestSuite && currentSuite == nullptr);
+        const auto start = steady_clock::now();
+        {
+            _private::TestCaseContextGuard guard(t->context);
+            try {
+                t->fn();
+            }
+            catch (...) {
+                t->exception = current_exception();
+            }
+        }
+        t->fn = nullptr;    // Release anything captured by the task.
+        const duration<double> elapsed = steady_clock::now() - start;
+        {
+            lock_guard<mutex> l(lock);
+            t->done = true;
+            if (isHelping) {
+                helpingTime[this_thread::get_id()] += elapsed.count();
+            }
+        }
+        cv.notify_all();
+    }
+
+    task_t submit(function<void()> fn, bool isTestSuite, bool isForIdleThreads = false) {
+        auto t = make_shared<Task>();
+        t->fn = move(fn);
+        t->context = _private::currentTestCaseContext();
+        t->isTestSuite = isTestSuite;
+        t->isForIdleThreads = isForIdleThreads;
+        {
+            lock_guard<mutex> l(lock);
+            (isTestSuite || isForIdleThreads ? testSuites : tasks).push_back(t);
+        }
+        cv.notify_all();
+        return t;
+    }
+
+    // Submit a task that, like a test suite, is only taken by idle workers (and the main
+    // thread), never by a test case waiting on its own tasks. Use this for work that may
+    // take as long as a test suite, with withdraw() to take back what no one has started.
+    task_t submitForIdleThreads(function<void()> fn) {
+        return submit(move(fn), false, true);
+    }
+
+    // Remove a task for idle threads that no thread has started, marking it as done.
+    void withdraw(const task_t& t) {
+        lock_guard<mutex> l(lock);
+        const auto it = find(testSuites.begin(), testSuites.end(), t);
+        if (it != testSuites.end()) {
+            testSuites.erase(it);
+            t->fn = nullptr;
+            t->done = true;
+        }
+    }
+
+    // Wait until the predicate is true, running other tasks while we do. The predicate
+    // is called with the lock held and is checked again each time a task completes.
+    void waitUntil(const function<bool()>& pred, bool helpWithTestSuites) {
+        unique_lock<mutex> l(lock);
+        while (!pred()) {
+            if (auto next = nextTask(helpWithTestSuites)) {
+                l.unlock();
+                runTask(next);
+                l.lock();
+            }
+            else {
+                cv.wait(l);
+            }
+        }
+    }
+
+    // Wait for the task to complete, running other tasks while we do.
+    void wait(const task_t& t, bool helpWithTestSuites) {
+        waitUntil([&t]{ return t->done; }, helpWithTestSuites);
+    }
+
+    void wait(const vector<task_t>& ts, bool helpWithTestSuites) {
+        exception_ptr firstException;
+        for (const auto& t : ts) {
+            wait(t, helpWithTestSuites);
+            if (t->exception && !firstException) {
+                firstException = t->exception;
+            }
+        }
+        if (firstException) {
+            rethrow_exception(firstException);
+        }
+    }
+
+    void workerLoop() {
+        unique_lock<mutex> l(lock);
+        while (true) {
+            if (auto t = nextTask(true)) {
+                l.unlock();
+                runTask(t);
+                l.lock();
+            }
+            else {
+                cv.wait(l);
+            }
+        }
+    }
+};
+
+Executor::Executor() : _impl(new Impl()) {
+    // The thread that waits on the tasks (typically the main thread) also runs them,
+    // hence one fewer worker than the hardware supports. The hardware concurrency may
+    // be reported as 0 if it cannot be determined.
+    const unsigned hc = thread::hardware_concurrency();
+    _impl->numberOfWorkers = (hc > 1 ? hc - 1 : 1);
+    for (unsigned i = 0; i < _impl->numberOfWorkers; ++i) {
+        thread([impl = _impl.get()]{ impl->workerLoop(); }).detach();
+    }
+}
+
+Executor::~Executor() noexcept {}
+
+Executor::task_t Executor::submit(function<void()> fn) {
+    return _impl->submit(move(fn), false);
+}
+
+void Executor::wait(const task_t& task) {
+    _impl->wait(task, false);
+    if (task->exception) {
+        rethrow_exception(task->exception);
+    }
+}
+
+void Executor::wait(const vector<task_t>& tasks) {
+    _impl->wait(tasks, false);
+}
+
+unsigned Executor::concurrency() const noexcept {
+    return _impl->numberOfWorkers;
+}
+
+namespace kss::test {
+    Executor& executor() {
+        // The executor is never deleted since its workers are detached and may still
+        // be waiting for work when the process exits.
+        static once_flag flag;
+        static Executor* ex = nullptr;
+        call_once(flag, [&]{ ex = new Executor(); });
+        return *ex;
+    }
+}
+
+namespace {
+    Executor::task_t submitForIdleThreads(function<void()> fn) {
+        return executor()._implementation()->submitForIdleThreads(move(fn));
+    }
+
+    void withdrawAndWait(const vector<Executor::task_t>& tasks) {
+        auto* impl = executor()._implementation();
+        for (const auto& t : tasks) {
+            impl->withdraw(t);
+        }
+        impl->wait(tasks, false);
+    }
+}
+
+
+// MARK: Test reporting
+
+namespace {
+    void printTestRunHeader() {
+        if (!isQuietMode) {
+            cout << "Running test suites for " << reportSummary.nameOfTestRun << "..." << endl;;
+            if (!isVerboseMode) {
+                cout << "  ";
+                flush(cout);    // Need flush before we start any threads.
+            }
+        }
+    }
+
+    // Output the --slowest and --suite-time-budget parts of the summary.
+    void outputPerformanceSummary() {
+        vector<const TestSuiteWrapper*> suites;
+        for (const auto& ts : *testSuites()) {
+            if (!ts.filteredOut && !ts.cancelled) {
+                suites.push_back(&ts);
+            }
+        }
+        auto bySuiteDuration = [](const TestSuiteWrapper* a, const TestSuiteWrapper* b) {
+            return a->durationOfTestSuite > b->durationOfTestSuite;
+        };
+
+        if (numberOfSlowestToShow > 0) {
+            cout << "  Performance:" << endl;
+            if (!reportSummary.cpuModel.empty()) {
+                cout << "    CPU: " << reportSummary.cpuModel;
+                if (!reportSummary.cpuGovernor.empty()) {
+                    cout << " (" << reportSummary.cpuGovernor << " governor)";
+                }
+                cout << endl;
+            }
+            if (!reportSummary.loadAverage.empty()) {
+                cout << "    Load average at start: " << reportSummary.loadAverage << endl;
+            }
+            const auto n = min(size_t(numberOfSlowestToShow), suites.size());
+            partial_sort(suites.begin(), suites.begin() + n, suites.end(), bySuiteDuration);
+            cout << "    Slowest test suites:" << endl;
+            for (size_t i = 0; i < n; ++i) {
+                cout << "      " << suites[i]->durationOfTestSuite.count() << "s " << suites[i]->suite->name() << endl;
+            }
+
+            vector<pair<const TestSuiteWrapper*, const TestCaseWrapper*>> cases;
+            for (const auto* ts : suites) {
+                for (const auto& t : ts->suite->_implementation()->tests) {
+                    cases.emplace_back(ts, &t);
+                }
+            }
+            const auto m = min(size_t(numberOfSlowestToShow), cases.size());
+            partial_sort(cases.begin(), cases.begin() + m, cases.end(), [](const auto& a, const auto& b) {
+                return a.second->durationOfTest > b.second->durationOfTest;
+            });
+            cout << "    Slowest test cases:" << endl;
+            for (size_t i = 0; i < m; ++i) {
+                cout << "      " << cases[i].second->durationOfTest.count() << "s "
+                    << cases[i].first->suite->name() << ": " << cases[i].second->name << endl;
+            }
+
+            // The parallelism achieved is the time spent running suites, plus the time
+            // threads spent helping with the tasks of other suites' test cases, compared
+            // to the wall time. This is also the sum of the utilization of each thread.
+            const auto wallTime = reportSummary.durationOfTestRun.count();
+            const auto numberOfThreads = executor().concurrency() + 1;
+            map<thread::id, double> busyTime;
+            busyTime[mainThreadId] = 0.0;
+            double totalBusyTime = 0.0;
+            for (const auto* ts : suites) {
+                busyTime[ts->ranOn] += ts->durationOfTestSuite.count();
+                totalBusyTime += ts->durationOfTestSuite.count();
+            }
+            {
+                auto* impl = executor()._implementation();
+                lock_guard<mutex> l(impl->lock);
+                for (const auto& [id, helping] : impl->helpingTime) {
+                    busyTime[id] += helping;
+                    totalBusyTime += helping;
+                }
+            }
+            if (wallTime > 0.0) {
+                cout << "    Parallelism: " << totalBusyTime / wallTime << " of " << numberOfThreads
+                    << (numberOfThreads == 1 ? " thread" : " threads") << endl;
+                cout << "      main thread " << lround(100.0 * busyTime[mainThreadId] / wallTime) << "% busy" << endl;
+                unsigned worker = 0;
+                for (const auto& [id, busy] : busyTime) {
+                    if (id != mainThreadId) {
+                        cout << "      worker " << ++worker << " " << lround(100.0 * busy / wallTime) << "% busy" << endl;
+                    }
+                }
+            }
+        }
+
+        if (suiteTimeBudget > 0.0) {
+            sort(suites.begin(), suites.end(), bySuiteDuration);
+            bool hasHeading = false;
+            for (const auto* ts : suites) {
+                if (ts->durationOfTestSuite.count() <= suiteTimeBudget) {
+                    break;
+                }
+                if (!hasHeading) {
+                    cout << "  Over the " << suiteTimeBudget << "s suite time budget:" << endl;
+                    hasHeading = true;
+                }
+                cout << "    " << ts->suite->name() << " took " << ts->durationOfTestSuite.count() << "s" << endl;
+            }
+        }
+    }
+
+    void outputStandardSummary() {
+        if (!isQuietMode) {
+            if (isParallel) {
+                flush(cout);    // Ensure all the thread output is flushed.
+            }
+            if (!isVerboseMode) {
+                cout << endl;
+            }
+
+            const auto* suites = testSuites();
+            const auto numberOfTestSuites = suites->size();
+            unsigned numberOfErrors = 0, numberOfFailures = 0, numberOfSkips = 0, numberPassed = 0;
+            unsigned numberFilteredOut = 0, numberCancelled = 0;
+            for (const auto& ts : *suites) {
+                if (ts.filteredOut) {
+                    ++numberFilteredOut;
+                    continue;
+                }
+                if (ts.cancelled) {
+                    ++numberCancelled;
+                    continue;
+                }
+
+                switch (ts.suite->_implementation()->result()) {
+                    case '.':    ++numberPassed; break;
+                    case 'S':    ++numberOfSkips; break;
+                    case 'E':    ++numberOfErrors; break;
+                    case 'F':    ++numberOfFailures; break;
+                }
+            }
+
+            const auto numberRun = numberOfTestSuites - numberFilteredOut - numberCancelled;
+            if (!numberOfFailures && !numberOfErrors && !numberOfSkips) {
+                cout << "  PASSED all " << numberRun << " test suites.";
+            }
+            else {
+                cout << "  Passed " << numberPassed << " of " << numberRun << " test suites";
+                if (numberOfSkips > 0) {
+                    cout << ", " << numberOfSkips << " skipped";
+                }
+                if (numberOfErrors > 0) {
+                    cout << ", " << numberOfErrors << (numberOfErrors == 1 ? " error" : " errors");
+                }
+                if (numberOfFailures > 0) {
+                    cout << ", " << numberOfFailures << " failed";
+                }
+                cout << ".";
+            }
+
+            if (numberFilteredOut > 0) {
+                cout << "  (" << numberFilteredOut << " filtered out)";
+            }
+            cout << endl;
+            if (isCancelled) {
+                cout << "  Stopped early due to --stop-on-first-failure";
+                if (numberCancelled > 0) {
+                    cout << ", " << numberCancelled << " test "
+                        << (numberCancelled == 1 ? "suite was" : "suites were") << " not run";
+                }
+                cout << "." << endl;
+            }
+
+            if (!isVerboseMode) {
+                // If we are not verbose we need to identify the errors and failures. If
+                // we are verbose, then that information was displayed earlier.
+                if (numberOfErrors > 0) {
+                    cout << "  Errors:" << endl;
+                    for (const auto& ts : *suites) {
+                        for (const auto& t : ts.suite->_implementation()->tests) {
+                            for (const auto& err : t.errors) {
+                                cout << "    " << string(err) << endl;
+                            }
+                        }
+                    }
+                }
+                if (numberOfFailures > 0) {
+                    cout << "  Failures:" << endl;
+                    for (const auto& ts : *suites) {
+                        for (const auto& t : ts.suite->_implementation()->tests) {
+                            for (const auto& f : t.failures) {
+                                cout << "    " << f.first << endl;
+                                if (!f.second.empty()) {
+                                    cout << "       ↳" << f.second << endl;
+                                }
+                            }
+                        }
+                    }
+                }
+                if (isRepeating() && (numberOfFailures > 0 || numberOfErrors > 0)) {
+                    cout << "  Repetitions:" << endl;
+                    for (const auto& ts : *suites) {
+                        for (const auto& t : ts.suite->_implementation()->tests) {
+                            if (t.failedIterations > 0) {
+                                cout << "    " << ts.suite->name() << ": " << t.name << " "
+                                    << describeRepetitions(t) << endl;
+                            }
+                        }
+                    }
+                }
+            }
+
+            // The flaky test cases are listed in every mode, since they are not otherwise
+            // identified once they have passed.
+            if (reportSummary.numberOfFlakyTests > 0) {
+                cout << "  Flaky:" << endl;
+                for (const auto& ts : *suites) {
+                    for (const auto& t : ts.suite->_implementation()->tests) {
+                        if (t.flaky) {
+                            cout << "    " << ts.suite->name() << ": " << t.name
+                                << " passed on retry " << t.retries << endl;
+                            for (const auto& err : t.flakyErrors) {
+                                cout << "      " << string(err) << endl;
+                            }
+                            for (const auto& f : t.flakyFailures) {
+                                cout << "      " << f.first << endl;
+                                if (!f.second.empty()) {
+                                    cout << "         ↳" << f.second << endl;
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+
+            outputPerformanceSummary();
+            cout << "  Completed in " << reportSummary.durationOfTestRun.count() << "s." << endl;
+        }
+    }
+
+    // Add the seed of failed test cases, and the statistics of repeated ones, to a report.
+    template <class Node>
+    void addRepetitionAttributes(Node& n, const TestCaseWrapper& t) {
+        if (!t.errors.empty() || !t.failures.empty()) {
+            n["seed"] = to_string(t.seed);
+        }
+        if (t.iterations > 0) {
+            n["iterations"] = to_string(t.iterations);
+            n["failedIterations"] = to_string(t.failedIterations);
+            n["passRate"] = to_string(passRate(t));
+            n["meanTime"] = to_string(meanDuration(t));
+            n["timeStdDev"] = to_string(standardDeviationOfDuration(t));
+            if (t.firstFailedIteration >= 0) {
+                n["firstFailedIteration"] = to_string(t.firstFailedIteration);
+            }
+        }
+    }
+
+    // Add the --perf-counters counts to a report.
+    template <class Node>
+    void addCounterAttributes(Node& n, const TestCaseWrapper& t) {
+        for (const auto& [name, count] : t.counters) {
+            n[name] = to_string(count);
+        }
+    }
+
+    // Add the values measured by assertions to a report.
+    template <class Node>
+    void addMeasurementAttributes(Node& n, const TestCaseWrapper& t) {
+        for (const auto& [name, value] : t.measurements) {
+            n[name] = value;
+        }
+    }
+
+    // Add the machine's environment, which affects how comparable timings are from one run
+    // to another, to the root of a report.
+    template <class Node>
+    void addEnvironmentAttributes(Node& n) {
+        if (!reportSummary.cpuModel.empty()) n["cpu"] = reportSummary.cpuModel;
+        if (!reportSummary.cpuGovernor.empty()) n["cpuGovernor"] = reportSummary.cpuGovernor;
+        if (!reportSummary.loadAverage.empty()) n["loadAverage"] = reportSummary.loadAverage;
+        if (pinTimedCode) n["pinnedCpu"] = (pinnedCpu >= 0 ? to_string(pinnedCpu) : string("current"));
+        if (useColdCache) n["coldCache"] = "true";
+    }
+
+    // Add the results of --retries to a report.
+    template <class Node>
+    void addRetryAttributes(Node& n, const TestCaseWrapper& t) {
+        if (t.retries > 0) {
+            n["retries"] = to_string(t.retries);
+            n["flaky"] = (t.flaky ? "true" : "false");
+        }
+    }
+
+    template <class T, class Node>
+    struct AbstractGenerator {
+        virtual ~AbstractGenerator() = default;
+        AbstractGenerator(const AbstractGenerator&) = default;
+        AbstractGenerator(AbstractGenerator&&) = default;
+        AbstractGenerator& operator=(const AbstractGenerator&) = default;
+        AbstractGenerator& operator=(AbstractGenerator&&) = default;
+
+        Node* operator()() {
+            while (_it != _items.end() && !include(*_it)) {
+                ++_it;
+            }
+            if (_it == _items.end()) {
+                return nullptr;
+            }
+            else {
+                _n.clear();
+                populate();
+                ++_it;
+                return &_n;
+            }
+        }
+
+        virtual void populate() = 0;
+
+        // Override to leave items out of the report.
+        virtual bool include(const T&) const { return true; }
+
+    protected:
+        AbstractGenerator(const vector<T>& items) : _items(items) {
+            _it = _items.begin();
+        }
+        const vector<T>&                    _items;
+        typename vector<T>::const_iterator  _it;
+        Node                                _n;
+    };
+
+    // The failures of the earlier attempts of flaky test cases are written as flakyFailure
+    // and flakyError elements, as Maven Surefire does.
+    struct FailureXmlGenerator
+    : public AbstractGenerator<pair<string, string>, xml::simple_writer::node>
+    {
+        FailureXmlGenerator(const failures_t& failures, const char* elementName = "failure")
+        : AbstractGenerator(failures), _elementName(elementName)
+        {}
+        virtual ~FailureXmlGenerator() = default;
+
+        virtual void populate() override {
+            _n.name = _elementName;
+            _n["message"] = _it->first;
+            if (!_it->second.empty()) {
+                _n.text = _it->second;
+            }
+        }
+
+    private:
+        const char* _elementName;
+    };
+
+    struct ErrorXmlGenerator : public AbstractGenerator<TestError, xml::simple_writer::node> {
+        ErrorXmlGenerator(const vector<TestError>& errors, const char* elementName = "error")
+        : AbstractGenerator(errors), _elementName(elementName)
+        {}
+        virtual ~ErrorXmlGenerator() = default;
+
+        virtual void populate() override {
+            _n.name = _elementName;
+            _n["message"] = _it->errorMessage;
+            if (!_it->errorType.empty()) _n["type"] = _it->errorType;
+        }
+
+    private:
+        const char* _elementName;
+    };
+
+    struct TestCaseXmlGenerator : public AbstractGenerator<TestCaseWrapper, xml::simple_writer::node> {
+        TestCaseXmlGenerator(const vector<TestCaseWrapper>& testCases) : AbstractGenerator(testCases) {}
+        virtual ~TestCaseXmlGenerator() = default;
+
+        virtual void populate() override {
+            _n.name = "testcase";
+            _n["name"] = _it->name;
+            _n["assertions"] = to_string(_it->assertions);
+            _n["classname"] = (_it->owner ? _private::demangle(*(_it->owner)) : string("none"));
+            _n["time"] = to_string(_it->durationOfTest.count());
+            addRepetitionAttributes(_n, *_it);
+            addRetryAttributes(_n, *_it);
+            addCounterAttributes(_n, *_it);
+            addMeasurementAttributes(_n, *_it);
+            if (!_it->errors.empty() || !_it->failures.empty()) {
+                _n.children = {
+                    ErrorXmlGenerator(_it->errors),
+                    FailureXmlGenerator(_it->failures)
+                };
+            }
+            else if (_it->flaky) {
+                _n.children = {
+                    ErrorXmlGenerator(_it->flakyErrors, "flakyError"),
+                    FailureXmlGenerator(_it->flakyFailures, "flakyFailure")
+                };
+            }
+        }
+    };
+
+    struct TestSuiteXmlGenerator : public AbstractGenerator<TestSuiteWrapper, xml::simple_writer::node> {
+        TestSuiteXmlGenerator(const vector<TestSuiteWrapper>& suites) : AbstractGenerator(suites) {}
+        virtual ~TestSuiteXmlGenerator() = default;
+
+        virtual bool include(const TestSuiteWrapper& w) const override {
+            return !w.filteredOut;
+        }
+
+        virtual void populate() override {
+            _n.name = "testsuite";
+            _n["name"] = _it->suite->name();
+            _n["tests"] = to_string(_it->suite->_implementation()->tests.size());
+            _n["errors"] = to_string(_it->numberOfErrors);
+            _n["failures"] = to_string(_it->numberOfFailedAssertions);
+            _n["hostname"] = reportSummary.nameOfHost;
+            _n["id"] = to_string(id++);
+            _n["skipped"] = to_string(_it->numberOfSkippedTests);
+            _n["time"] = to_string(_it->durationOfTestSuite.count());
+            _n["timestamp"] = _it->timestamp;
+            _n.children = { TestCaseXmlGenerator(_it->suite->_implementation()->tests) };
+        }
+
+    private:
+        int id = 0;
+    };
+
+    void writeXmlReportToStream(ostream& strm) {
+        xml::simple_writer::node root;
+        root.name = "testsuites";
+        root["errors"] = to_string(reportSummary.numberOfErrors);
+        root["failures"] = to_string(reportSummary.numberOfFailures);
+        root["name"] = reportSummary.nameOfTestRun;
+        root["tests"] = to_string(reportSummary.numberOfAssertions - reportSummary.numberOfFailures);
+        root["time"] = to_string(reportSummary.durationOfTestRun.count());
+        if (retryCount > 0) {
+            root["flaky"] = to_string(reportSummary.numberOfFlakyTests);
+        }
+        addEnvironmentAttributes(root);
+        const auto* suites = testSuites();
+        root.children = { TestSuiteXmlGenerator(*suites) };
+        xml::simple_writer::write(strm, root);
+    }
+
+    void printXmlReport() {
+        if (xmlReportFilename == "-") {
+            if (!isQuietMode || jsonReportFilename == "-") {
+                cout << "==XML=REPORT===================================" << endl;
+            }
+            writeXmlReportToStream(cout);
+        }
+        else {
+            write_file(xmlReportFilename, [&](ofstream& strm) {
+                writeXmlReportToStream(strm);
+            });
+            if (!isQuietMode) {
+                cout << "  Wrote XML report to " << xmlReportFilename << endl;
+            }
+        }
+    }
+
+
+    struct FailureJsonGenerator
+    : public AbstractGenerator<pair<string, string>, json::simple_writer::node>
+    {
+        FailureJsonGenerator(const failures_t& failures) : AbstractGenerator(failures) {}
+        virtual ~FailureJsonGenerator() = default;
+
+        virtual void populate() override {
+            _n["message"] = _it->first;
+            if (!_it->second.empty()) {
+                _n["message"] += " (" + _it->second + ")";
+            }
+        }
+    };
+
+    struct ErrorJsonGenerator : public AbstractGenerator<TestError, json::simple_writer::node> {
+        ErrorJsonGenerator(const vector<TestError>& errors) : AbstractGenerator(errors) {}
+        virtual ~ErrorJsonGenerator() = default;
+
+        virtual void populate() override {
+            _n["message"] = _it->errorMessage;
+            if (!_it->errorType.empty()) _n["type"] = _it->errorType;
+        }
+    };
+
+    struct TestCaseJsonGenerator : public AbstractGenerator<TestCaseWrapper, json::simple_writer::node> {
+        TestCaseJsonGenerator(const vector<TestCaseWrapper>& tests) : AbstractGenerator(tests) {}
+        virtual ~TestCaseJsonGenerator() = default;
+
+        virtual void populate() override {
+            _n["name"] = _it->name;
+            _n["status"] = (_it->skipped ? "NOTRUN" : "RUN");
+            _n["time"] = to_string(_it->durationOfTest.count());
+            _n["classname"] = (_it->owner ? _private::demangle(*(_it->owner)) : string("none"));
+            addRepetitionAttributes(_n, *_it);
+            addRetryAttributes(_n, *_it);
+            addCounterAttributes(_n, *_it);
+            addMeasurementAttributes(_n, *_it);
+            if (!_it->errors.empty()) {
+                _n.arrays.push_back(make_pair("errors", ErrorJsonGenerator(_it->errors)));
+            }
+            if (!_it->failures.empty()) {
+                _n.arrays.push_back(make_pair("failures", FailureJsonGenerator(_it->failures)));
+            }
+            if (!_it->flakyErrors.empty()) {
+                _n.arrays.push_back(make_pair("flakyErrors", ErrorJsonGenerator(_it->flakyErrors)));
+            }
+            if (!_it->flakyFailures.empty()) {
+                _n.arrays.push_back(make_pair("flakyFailures", FailureJsonGenerator(_it->flakyFailures)));
+            }
+        }
+    };
+
+    struct TestSuiteJsonGenerator : public AbstractGenerator<TestSuiteWrapper, json::simple_writer::node> {
+        TestSuiteJsonGenerator(const vector<TestSuiteWrapper>& suites) : AbstractGenerator(suites) {}
+        virtual ~TestSuiteJsonGenerator() = default;
+
+        virtual bool include(const TestSuiteWrapper& w) const override {
+            return !w.filteredOut;
+        }
+
+        virtual void populate() override {
+            _n["name"] = _it->suite->name();
+            _n["tests"] = to_string(_it->suite->_implementation()->tests.size());
+            _n["failures"] = to_string(_it->numberOfFailedTests);
+            _n["errors"] = to_string(_it->numberOfErrors);
+            _n["time"] = to_string(_it->durationOfTestSuite.count());
+            _n.arrays = { make_pair("testsuite", TestCaseJsonGenerator(_it->suite->_implementation()->tests)) };
+        }
+    };
+
+    void writeJsonReportToStream(ostream& strm) {
+        json::simple_writer::node n;
+        n["tests"] = to_string(reportSummary.numberOfTests);
+        n["failures"] = to_string(reportSummary.numberOfFailures);
+        n["errors"] = to_string(reportSummary.numberOfErrors);
+        n["time"] = to_string(reportSummary.durationOfTestRun.count());
+        n["timestamp"] = reportSummary.timeOfTestRun;
+        n["name"] = reportSummary.nameOfTestRun;
+        if (retryCount > 0) {
+            n["flaky"] = to_string(reportSummary.numberOfFlakyTests);
+        }
+        addEnvironmentAttributes(n);
+        const auto* suites = testSuites();
+        n.arrays = { make_pair("testsuites", TestSuiteJsonGenerator(*suites)) };
+        json::simple_writer::write(strm, n);
+    }
+
+    void printJsonReport() {
+        if (jsonReportFilename == "-") {
+            if (!isQuietMode || xmlReportFilename == "-") {
+                cout << "==JSON=REPORT==================================" << endl;
+            }
+            writeJsonReportToStream(cout);
+        }
+        else {
+            write_file(jsonReportFilename, [&](ofstream& strm) {
+                writeJsonReportToStream(strm);
+            });
+            if (!isQuietMode) {
+                cout << "  Wrote JSON report to " << jsonReportFilename << endl;
+            }
+        }
+    }
+
+    void printTestRunSummary() {
+        if (!isQuietMode) {
+            TraceSpan span("summary", "report");
+            outputStandardSummary();
+        }
+        if (!xmlReportFilename.empty()) {
+            TraceSpan span("XML report", "report");
+            printXmlReport();
+        }
+        if (!jsonReportFilename.empty()) {
+            TraceSpan span("JSON report", "report");
+            printJsonReport();
+        }
+    }
+
+    void printTestSuiteHeader(const TestSuite& ts) {
+        if (isVerboseMode) {
+            cout << "  " << ts.name() << endl;
+        }
+    }
+
+    void printTestSuiteSummary(const TestSuiteWrapper& w) {
+        if (!isQuietMode) {
+            const auto* impl = w.suite->_implementation();
+            if (isVerboseMode) {
+                unsigned numberOfAssertions = 0;
+                for (const auto& t : impl->tests) {
+                    numberOfAssertions += t.assertions;
+                }
+
+                if (!w.numberOfErrors && !w.numberOfFailedAssertions) {
+                    cout << "    PASSED all " << numberOfAssertions << " checks";
+                }
+                else {
+                    cout << "    Passed " << numberOfAssertions << " checks";
+                }
+
+                if (w.numberOfSkippedTests > 0) {
+                    cout << ", " << w.numberOfSkippedTests << " test " << (w.numberOfSkippedTests == 1 ? "case" : "cases") << " SKIPPED";
+                }
+                if (w.numberOfErrors > 0) {
+                    cout << ", " << w.numberOfErrors << (w.numberOfErrors == 1 ? " error" : " errors");
+                }
+                if (w.numberOfFailedAssertions > 0) {
+                    cout << ", " << w.numberOfFailedAssertions << " FAILED";
+                }
+                cout << "." << endl;
+
+                if (w.numberOfErrors > 0) {
+                    cout << "    Errors:" << endl;
+                    for (const auto& t : impl->tests) {
+                        for (const auto& err : t.errors) {
+                            cout << "      " << string(err) << endl;
+                        }
+                    }
+                }
+                if (w.numberOfFailedAssertions > 0) {
+                    cout << "    Failures:" << endl;
+                    for (const auto& t : impl->tests) {
+                        for (const auto& f : t.failures) {
+                            cout << "      " << f.first << endl;
+                            if (!f.second.empty()) {
+                                cout << "         ↳" << f.second << endl;
+                            }
+                        }
+                    }
+                }
+            }
+            // In the normal mode the ProgressReporter shows the result.
+        }
+    }
+
+    void printTestCaseHeader(const TestCaseWrapper& t) {
+        if (isVerboseMode) {
+            cout << "    " << t.name << " ";
+        }
+    }
+
+    void printTestCaseSummary(const TestCaseWrapper& t) {
+        if (isVerboseMode) {
+            cout << endl;
+        }
+    }
+
+    int testResultCode() {
+        if (reportSummary.numberOfErrors > 0) {
+            return -1;
+        }
+        return reportSummary.numberOfFailures;
+    }
+
+    // Run the test suite. If a suite that it depends on failed, its name is given by
+    // failedPrerequisite and the test cases are all skipped instead.
+    void runTestSuite(TestSuiteWrapper* wrapper, const string& failedPrerequisite = string()) {
+        if (!passesFilter(*wrapper->suite) && !wrapper->isPrerequisite) {
+            wrapper->filteredOut = true;
+            return;
+        }
+
+        wrapper->timestamp = now();
+        wrapper->ranOn = this_thread::get_id();
+        auto* impl = wrapper->suite->_implementation();
+        currentSuite = wrapper;
+        TraceSpan span(wrapper->suite->name(), "suite");
+        if (tracer.isEnabled()) {
+            tracer.suiteStarted();
+        }
+        finally suiteFinished([]{
+            if (tracer.isEnabled()) {
+                tracer.suiteFinished();
+            }
+        });
+
+        // If the run has been cancelled, we still record the test cases (as not run) so
+        // that they appear in the reports.
+        if (isCancelled) {
+            wrapper->cancelled = true;
+            for (auto& t : impl->tests) {
+                impl->skipTestCase(t);
+            }
+            currentSuite = nullptr;
+            return;
+        }
+
+        printTestSuiteHeader(*wrapper->suite);
+        reporterPipeline().post(Reporter::Event::Kind::SuiteStarted, wrapper->suite->name());
+        finally reportSuiteFinished([&]{
+            reporterPipeline().post(Reporter::Event::Kind::SuiteFinished, wrapper->suite->name(), string(),
+                                  string(), statusFromResultCharacter(impl->result()),
+                                  wrapper->durationOfTestSuite);
+        });
+        if (!failedPrerequisite.empty()) {
+            if (isVerboseMode) {
+                cout << "    SKIPPED since " << failedPrerequisite << " failed" << endl;
+            }
+            for (auto& t : impl->tests) {
+                impl->skipTestCase(t);
+                postTestCaseFinished(t);
+            }
+            currentSuite = nullptr;
+            printTestSuiteSummary(*wrapper);
+            return;
+        }
+
+        if (impl->createTestCases) {
+            impl->createTestCases(impl->tests);
+        }
+        if (!rerunFailedFilename.empty()) {
+            impl->removeTestCasesNotToRerun();
+        }
+        impl->addBeforeAndAfterAll();
+        wrapper->durationOfTestSuite = timeOfExecution([&]{
+            if (isRepeating()) {
+                impl->runTestCasesRepeatedly();
+                return;
+            }
+            if (isParallel && impl->mayRunTestCasesInParallel) {
+                impl->runTestCasesInParallel();
+                return;
+            }
+            for (auto& t : impl->tests) {
+                // Failed test cases are retried before the AfterAll cleans up the suite.
+                if (t.isAfterAll) {
+                    impl->retryFailedTestCases();
+                }
+
+                // Once cancelled we stop starting test cases, other than the AfterAll
+                // which is needed to clean up after the ones that did run.
+                if (isCancelled && !t.isAfterAll) {
+                    impl->skipTestCase(t);
+                    postTestCaseFinished(t);
+                    continue;
+                }
+                printTestCaseHeader(t);
+                impl->runTestCase(t);
+                printTestCaseSummary(t);
+            }
+            impl->retryFailedTestCases();
+        });
+
+        currentSuite = nullptr;
+        printTestSuiteSummary(*wrapper);
+    }
+
+    // Returns the names of the test suites that failed in the previous run, read from
+    // the --failed-first file. A missing file means there were none.
+    set<string> readPreviouslyFailedTestSuites() {
+        set<string> names;
+        if (exists(failedFirstFilename)) {
+            errno = 0;
+            ifstream strm(failedFirstFilename);
+            if (!strm.is_open()) { throwProcessingError(failedFirstFilename, "Failed to open"); }
+            string line;
+            while (getline(strm, line)) {
+                if (!line.empty()) {
+                    names.insert(line);
+                }
+            }
+            if (strm.bad()) { throwProcessingError(failedFirstFilename, "Failed while reading"); }
+        }
+        return names;
+    }
+
+    // Returns the test cases, by suite, that failed or had errors in the report given by
+    // --rerun-failed. The report may be either XML or JSON.
+    map<string, set<string>> readFailedTestCasesFromReport() {
+        errno = 0;
+        ifstream strm(rerunFailedFilename);
+        if (!strm.is_open()) { throwProcessingError(rerunFailedFilename, "Failed to open"); }
+        ostringstream contents;
+        contents << strm.rdbuf();
+        if (strm.bad()) { throwProcessingError(rerunFailedFilename, "Failed while reading"); }
+
+        // If the report was captured from the standard output, it follows a tag line
+        // (e.g. "==XML=REPORT==") and may be followed by another report.
+        auto doc = contents.str();
+        const auto tag = min(doc.find("==XML=REPORT=="), doc.find("==JSON=REPORT=="));
+        if (tag != string::npos) {
+            doc.erase(0, doc.find('\n', tag));
+            const auto nextTag = min(doc.find("==XML=REPORT=="), doc.find("==JSON=REPORT=="));
+            if (nextTag != string::npos) {
+                doc.erase(nextTag);
+            }
+        }
+        const auto start = doc.find_first_of("<{");
+        if (start == string::npos) {
+            throw invalid_argument(rerunFailedFilename + " is not an XML or JSON test report");
+        }
+        doc.erase(0, start);
+
+        map<string, set<string>> failed;
+        if (doc[0] == '<') {
+            const auto root = xml::simple_reader::read(doc);
+            for (const auto& ts : root.children) {
+                for (const auto& tc : ts.children) {
+                    const bool hasFailed = any_of(tc.children.begin(), tc.children.end(), [](const auto& e) {
+                        return e.name == "failure" || e.name == "error";
+                    });
+                    if (tc.name == "testcase" && hasFailed) {
+                        failed[ts.attributes.at("name")].insert(tc.attributes.at("name"));
+                    }
+                }
+            }
+        }
+        else {
+            const auto root = json::simple_reader::read(doc);
+            const auto suites = root.arrays.find("testsuites");
+            if (suites != root.arrays.end()) {
+                for (const auto& ts : suites->second) {
+                    const auto cases = ts.arrays.find("testsuite");
+                    if (cases == ts.arrays.end()) {
+                        continue;
+                    }
+                    for (const auto& tc : cases->second) {
+                        if (tc.arrays.count("failures") || tc.arrays.count("errors")) {
+                            failed[ts.attributes.at("name")].insert(tc.attributes.at("name"));
+                        }
+                    }
+                }
+            }
+        }
+        return failed;
+    }
+
+    // Record the test suites that failed in this run. Those that did not run this time
+    // (filtered out or cancelled) remain failed if they failed previously.
+    void writeFailedTestSuites(const set<string>& previouslyFailed) {
+        write_file_atomically(failedFirstFilename, [&](ofstream& strm) {
+            for (const auto& ts : *testSuites()) {
+                const auto& name = ts.suite->name();
+                const bool didNotRun = ts.filteredOut || ts.cancelled;
+                const auto res = ts.suite->_implementation()->result();
+                if ((didNotRun && previouslyFailed.count(name))
+                    || (!didNotRun && (res == 'E' || res == 'F')))
+                {
+                    strm << name << endl;
+                }
+            }
+        });
+    }
+}
+
+
+// MARK: Test suite scheduling
+
+namespace {
+
+    // Runs the test suites, in parallel if requested, subject to the resources they need
+    // and the suites they depend on. Suites are started in order as soon as they can be,
+    // and each time one finishes we look for more that can now be started. Those that
+    // must be run on the main thread (all of them if we are not parallel) are run by
+    // run() itself, which otherwise helps the executor.
+    class TestSuiteScheduler {
+    public:
+        TestSuiteScheduler(vector<TestSuiteWrapper>& suites, bool parallel)
+        : capacities(resourceCapacities)
+        {
+            capacities.emplace("cores", parallel ? executor().concurrency() + 1 : 1);
+            capacities.emplace("memoryMB", physicalMemoryMB());
+            if (!memoryEstimatesFilename.empty()) {
+                isMeasuringMemory = true;
+                memoryEstimates = readMemoryEstimates();
+            }
+
+            entries.reserve(suites.size());
+            for (auto& ts : suites) {
+                Entry e;
+                e.wrapper = &ts;
+                e.mainThreadOnly = (!parallel || as<MustNotBeParallel>(ts.suite) != nullptr);
+                if (auto* ur = as<UsesResources>(ts.suite)) {
+                    e.needs = ur->resources();
+                }
+                e.needs.emplace("cores", 1);
+                if (const auto it = memoryEstimates.find(ts.suite->name()); it != memoryEstimates.end()) {
+                    e.needs.emplace("memoryMB", it->second);
+                }
+                for (auto& [name, amount] : e.needs) {
+                    amount = min(amount, capacity(name));
+                }
+                entries.push_back(move(e));
+            }
+
+            addDependencies();
+            includePrerequisites();
+        }
+
+        void run() {
+            if (isMeasuringMemory) {
+                sampler = thread([this]{ sampleMemory(); });
+            }
+            finally cleanup([this]{
+                if (sampler.joinable()) {
+                    {
+                        lock_guard<mutex> l(lock);
+                        stopSampling = true;
+                    }
+                    samplerCv.notify_all();
+                    sampler.join();
+                }
+            });
+
+            startReadySuites();
+
+            unique_lock<mutex> l(lock);
+            while (numberFinished < entries.size()) {
+                if (auto* e = nextReadySuite(true)) {
+                    l.unlock();
+                    runSuite(*e);
+                    l.lock();
+                }
+                else {
+                    const size_t seen = numberFinished;
+                    l.unlock();
+                    executor()._implementation()->waitUntil([&]{ return numberFinished != seen; }, true);
+                    l.lock();
+                }
+            }
+
+            l.unlock();
+            if (isMeasuringMemory) {
+                writeMemoryEstimates();
+            }
+
+            if (firstException) {
+                rethrow_exception(firstException);
+            }
+        }
+
+    private:
+        struct Entry {
+            TestSuiteWrapper*           wrapper = nullptr;
+            UsesResources::resources_t  needs;
+            vector<Entry*>              prerequisites;
+            vector<Entry*>              dependents;
+            bool                        mainThreadOnly = false;
+            bool                        started = false;
+            unsigned                    numberOfUnfinishedPrerequisites = 0;
+            string                      failedPrerequisite;
+            bool                        isRunning = false;
+            int64_t                     memoryCharged = 0;      // Bytes, since it started.
+            int64_t                     peakMemoryCharged = 0;
+        };
+
+        mutex                       lock;
+        map<string, unsigned>       capacities;
+        map<string, unsigned>       inUse;          // Guarded by lock.
+        vector<Entry>               entries;        // started is guarded by lock.
+        atomic<size_t>              numberFinished { 0 };
+        exception_ptr               firstException;
+
+        bool                        isMeasuringMemory = false;
+        map<string, unsigned>       memoryEstimates;        // Megabytes by suite name.
+        thread                      sampler;
+        condition_variable          samplerCv;
+        bool                        stopSampling = false;   // Guarded by lock.
+        size_t                      lastMemoryInUse = 0;    // Guarded by lock.
+
+        static constexpr size_t     megabyte = 1024 * 1024;
+        static constexpr auto       memorySamplingInterval = 5ms;
+
+        // Returns the peak memory estimates from the previous run.
+        map<string, unsigned> readMemoryEstimates() const {
+            map<string, unsigned> estimates;
+            if (exists(memoryEstimatesFilename)) {
+                errno = 0;
+                ifstream strm(memoryEstimatesFilename);
+                if (!strm.is_open()) { throwProcessingError(memoryEstimatesFilename, "Failed to open"); }
+                unsigned mb = 0;
+                string name;
+                while (strm >> mb && getline(strm >> ws, name)) {
+                    estimates[name] = mb;
+                }
+                if (strm.bad()) { throwProcessingError(memoryEstimatesFilename, "Failed while reading"); }
+            }
+            return estimates;
+        }
+
+        // Record the peak memory measured for the suites that ran, keeping the previous
+        // estimates for those that did not.
+        void writeMemoryEstimates() {
+            auto estimates = memoryEstimates;
+            for (const auto& e : entries) {
+                const auto* w = e.wrapper;
+                if (e.started && !w->filteredOut && !w->cancelled && e.failedPrerequisite.empty()) {
+                    const auto peak = size_t(e.peakMemoryCharged);
+                    estimates[nameOf(e)] = unsigned((peak + megabyte - 1) / megabyte);
+                }
+            }
+            write_file_atomically(memoryEstimatesFilename, [&](ofstream& strm) {
+                for (const auto& [name, mb] : estimates) {
+                    strm << mb << " " << name << endl;
+                }
+            });
+        }
+
+        // Charge the change in the memory in use since the previous sample to the suites
+        // that are running. Since we cannot tell which of them allocated it, the change is
+        // shared equally between them. Each suite is only charged for the changes made
+        // while it runs, so the memory in use when it started (including that of the
+        // suites already running) is not counted against it. Must be called with the
+        // lock held.
+        void chargeMemoryInUse(size_t memory) {
+            const auto change = int64_t(memory) - int64_t(lastMemoryInUse);
+            lastMemoryInUse = memory;
+            const auto numberRunning = count_if(entries.begin(), entries.end(), [](const Entry& e) {
+                return e.isRunning;
+            });
+            if (numberRunning == 0) {
+                return;
+            }
+            for (auto& e : entries) {
+                if (e.isRunning) {
+                    e.memoryCharged += change / numberRunning;
+                    e.peakMemoryCharged = max(e.peakMemoryCharged, e.memoryCharged);
+                }
+            }
+        }
+
+        // Periodically sample the memory in use while the suites run.
+        void sampleMemory() {
+            unique_lock<mutex> l(lock);
+            while (!stopSampling) {
+                l.unlock();
+                const auto memory = memoryInUse();
+                l.lock();
+                chargeMemoryInUse(memory);
+                samplerCv.wait_for(l, memorySamplingInterval);
+            }
+        }
+
+        void startMeasuringMemory(Entry& e) {
+            if (isMeasuringMemory) {
+                const auto memory = memoryInUse();
+                lock_guard<mutex> l(lock);
+                chargeMemoryInUse(memory);
+                e.isRunning = true;
+                e.memoryCharged = e.peakMemoryCharged = 0;
+            }
+        }
+
+        void stopMeasuringMemory(Entry& e) {
+            if (isMeasuringMemory) {
+                const auto memory = memoryInUse();
+                lock_guard<mutex> l(lock);
+                chargeMemoryInUse(memory);
+                e.isRunning = false;
+            }
+        }
+
+        const string& nameOf(const Entry& e) const {
+            return e.wrapper->suite->name();
+        }
+
+        // Link each suite to those it depends on, checking that they all exist and that
+        // there are no cycles.
+        void addDependencies() {
+            map<string, vector<Entry*>> entriesByName;
+            for (auto& e : entries) {
+                entriesByName[nameOf(e)].push_back(&e);
+            }
+
+            for (auto& e : entries) {
+                if (auto* hd = as<HasDependencies>(e.wrapper->suite)) {
+                    for (const auto& name : hd->dependencies()) {
+                        const auto it = entriesByName.find(name);
+                        if (it == entriesByName.end()) {
+                            throw invalid_argument("Test suite '" + nameOf(e)
+                                                   + "' depends on the unknown test suite '"
+                                                   + name + "'");
+                        }
+                        for (auto* prerequisite : it->second) {
+                            e.prerequisites.push_back(prerequisite);
+                            prerequisite->dependents.push_back(&e);
+                            ++e.numberOfUnfinishedPrerequisites;
+                        }
+                    }
+                }
+            }
+
+            // Remove the suites in topological order, anything left is part of a cycle.
+            map<const Entry*, unsigned> remaining;
+            vector<const Entry*> ready;
+            for (const auto& e : entries) {
+                remaining[&e] = e.numberOfUnfinishedPrerequisites;
+                if (e.numberOfUnfinishedPrerequisites == 0) {
+                    ready.push_back(&e);
+                }
+            }
+            while (!ready.empty()) {
+                const auto* e = ready.back();
+                ready.pop_back();
+                remaining.erase(e);
+                for (const auto* dependent : e->dependents) {
+                    if (--remaining[dependent] == 0) {
+                        ready.push_back(dependent);
+                    }
+                }
+            }
+            if (!remaining.empty()) {
+                string names;
+                for (const auto& p : remaining) {
+                    names += (names.empty() ? "'" : ", '") + nameOf(*p.first) + "'";
+                }
+                throw invalid_argument("The dependencies of the test suites " + names
+                                       + " form a cycle");
+            }
+        }
+
+        // Ensure that the suites that pass the filter can run, even if those they depend
+        // on do not pass it.
+        void includePrerequisites() {
+            vector<Entry*> toVisit;
+            for (auto& e : entries) {
+                if (passesFilter(*e.wrapper->suite)) {
+                    toVisit.push_back(&e);
+                }
+            }
+            while (!toVisit.empty()) {
+                auto* e = toVisit.back();
+                toVisit.pop_back();
+                for (auto* prerequisite : e->prerequisites) {
+                    if (!prerequisite->wrapper->isPrerequisite) {
+                        prerequisite->wrapper->isPrerequisite = true;
+                        toVisit.push_back(prerequisite);
+                    }
+                }
+            }
+        }
+
+        unsigned capacity(const string& name) const {
+            const auto it = capacities.find(name);
+            return (it == capacities.end() ? 1 : it->second);
+        }
+
+        // Must be called with the lock held.
+        bool resourcesAreAvailable(const Entry& e) const {
+            for (const auto& [name, amount] : e.needs) {
+                const auto it = inUse.find(name);
+                const auto used = (it == inUse.end() ? 0 : it->second);
+                if (used + amount > capacity(name)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // Returns the first suite that has not been started, whose prerequisites have
+        // finished and whose resources are available, or nullptr if there is none. The
+        // suite is marked as started and its resources are taken. Nothing is reserved
+        // for the suites that were passed over. Must be called with the lock held.
+        Entry* nextReadySuite(bool mainThreadOnly) {
+            for (auto& e : entries) {
+                if (!e.started
+                    && e.mainThreadOnly == mainThreadOnly
+                    && e.numberOfUnfinishedPrerequisites == 0
+                    && resourcesAreAvailable(e))
+                {
+                    e.started = true;
+                    for (const auto& [name, amount] : e.needs) {
+                        inUse[name] += amount;
+                    }
+                    return &e;
+                }
+            }
+            return nullptr;
+        }
+
+        // Hand all the suites that can now be started to the executor.
+        void startReadySuites() {
+            vector<Entry*> ready;
+            {
+                lock_guard<mutex> l(lock);
+                while (auto* e = nextReadySuite(false)) {
+                    ready.push_back(e);
+                }
+            }
+
+            if (!ready.empty()) {
+                auto* ex = executor()._implementation();
+                for (auto* e : ready) {
+                    (void) ex->submit([this, e]{ runSuite(*e); }, true);
+                }
+            }
+        }
+
+        void runSuite(Entry& e) {
+            bool succeeded = false;
+            try {
+                // failedPrerequisite cannot change once we have been started.
+                startMeasuringMemory(e);
+                finally stopMeasuring([&]{ stopMeasuringMemory(e); });
+                runTestSuite(e.wrapper, e.failedPrerequisite);
+                const auto res = e.wrapper->suite->_implementation()->result();
+                succeeded = (e.failedPrerequisite.empty()
+                             && !e.wrapper->cancelled
+                             && res != 'E' && res != 'F');
+            }
+            catch (...) {
+                lock_guard<mutex> l(lock);
+                if (!firstException) {
+                    firstException = current_exception();
+                }
+            }
+
+            {
+                lock_guard<mutex> l(lock);
+                for (const auto& [name, amount] : e.needs) {
+                    inUse[name] -= amount;
+                }
+                for (auto* dependent : e.dependents) {
+                    --dependent->numberOfUnfinishedPrerequisites;
+                    if (!succeeded && dependent->failedPrerequisite.empty()) {
+                        // If we were skipped, report the suite that actually failed.
+                        dependent->failedPrerequisite = (e.failedPrerequisite.empty()
+                                                         ? nameOf(e)
+                                                         : e.failedPrerequisite);
+                    }
+                }
+                ++numberFinished;
+            }
+            startReadySuites();
+        }
+    };
+}
+
+
+namespace kss::test {
+
+    int run(string_view testRunName, int argc, const char *const *argv) {
+        auto* suites = testSuites();
+        reportSummary.programName = path(argv[0]).filename();
+        reportSummary.nameOfTestRun = testRunName;
+        reportSummary.nameOfHost = hostname();
+        reportSummary.cpuModel = cpuModel();
+        reportSummary.cpuGovernor = cpuGovernor();
+        reportSummary.loadAverage = loadAverage();
+        mainThreadId = this_thread::get_id();
+        if (parseCommandLine(argc, argv)) {
+            printTestRunHeader();
+
+            sort(suites->begin(), suites->end());
+            set<string> previouslyFailed;
+            if (!failedFirstFilename.empty()) {
+                previouslyFailed = readPreviouslyFailedTestSuites();
+                stable_partition(suites->begin(), suites->end(), [&](const TestSuiteWrapper& ts) {
+                    return previouslyFailed.count(ts.suite->name()) > 0;
+                });
+            }
+
+            if (!rerunFailedFilename.empty()) {
+                testCasesToRerun = readFailedTestCasesFromReport();
+            }
+
+            if (!traceFilename.empty()) {
+                tracer.start();
+            }
+            finally stopTracing([]{ tracer.stop(); });
+
+            Profiler profiler;
+            if (!profileDirectory.empty()) {
+                profiler.start();
+            }
+            finally stopProfiling([&]{ profiler.stop(); });
+
+            if (!tapFilename.empty()) {
+                reporterPipeline().add(make_shared<TapReporter>(tapFilename));
+            }
+            if (!isQuietMode && !isVerboseMode) {
+                reporterPipeline().add(make_shared<ProgressReporter>());
+            }
+            reporterPipeline().start();
+            finally stopReporting([]{ reporterPipeline().stop(); });
+            reporterPipeline().post(Reporter::Event::Kind::RunStarted, string(), string(), reportSummary.nameOfTestRun);
+
+            reportSummary.timeOfTestRun = now();
+            reportSummary.durationOfTestRun = timeOfExecution([&]{
+                TestSuiteScheduler(*suites, isParallel).run();
+            });
+
+            // The reporters must have finished before the summary is written.
+            const auto runStatus = (reportSummary.numberOfErrors > 0 ? Reporter::Status::Error
+                                    : reportSummary.numberOfFailures > 0 ? Reporter::Status::Failed
+                                    : Reporter::Status::Passed);
+            reporterPipeline().post(Reporter::Event::Kind::RunFinished, string(), string(),
+                                  reportSummary.nameOfTestRun, runStatus, reportSummary.durationOfTestRun);
+            reporterPipeline().stop();
+            if (auto ex = reporterPipeline().exception()) {
+                rethrow_exception(ex);
+            }
+            if (!profileDirectory.empty()) {
+                profiler.stop();
+                profiler.write(profileDirectory);
+            }
+
+            printTestRunSummary();
+            if (!failedFirstFilename.empty()) {
+                writeFailedTestSuites(previouslyFailed);
+            }
+            if (!traceFilename.empty()) {
+                tracer.stop();
+                tracer.write(traceFilename);
+            }
+        }
+        delete suites;
+        return testResultCode();
+    }
+
+    void skip() {
+        throw SkipTestCase();
+    }
+
+    void addReporter(shared_ptr<Reporter> reporter) {
+        reporterPipeline().add(move(reporter));
+    }
+
+    void setResourceCapacity(const string& resourceName, unsigned capacity) {
+        resourceCapacities[resourceName] = capacity;
+    }
+
+    bool isQuiet() noexcept {
+        return isQuietMode;
+    }
+
+    bool isVerbose() noexcept {
+        return isVerboseMode;
+    }
+
+    uint64_t seed() noexcept {
+        assert(currentTest != nullptr);
+        return currentTest->seed;
+    }
+}
+
+
+// MARK: Death Tests
+
+namespace {
+
+    // How the child process of a death test ended.
+    struct DeathTestResult {
+        enum class Outcome { exited, signalled, returned, threw, terminated, timedOut };
+
+        Outcome outcome = Outcome::returned;
+        int     value = 0;          // The exit code or the signal number.
+        string  message;            // Description of the exception if one was thrown.
+
+        string describe(duration<double> timeout) const {
+            switch (outcome) {
+                case Outcome::exited:       return "exited with status " + to_string(value);
+                case Outcome::signalled:    return "was killed by signal " + to_string(value);
+                case Outcome::returned:     return "returned normally";
+                case Outcome::threw:        return "threw " + message;
+                case Outcome::terminated:   return "called terminate()";
+                case Outcome::timedOut: {
+                    ostringstream strm;
+                    strm << "did not finish within " << timeout.count() << "s and was killed";
+                    return strm.str();
+                }
+            }
+            return string();
+        }
+    };
+
+    // In the child process, this is where it tells the parent how it ended when that cannot
+    // be told from its exit status. The first character is the outcome.
+    static int deathTestReportFd = -1;
+
+    void reportToParent(char outcome, const string& message = string()) noexcept {
+        string buf(1, outcome);
+        buf += message.substr(0, 1000);
+        (void) ::write(deathTestReportFd, buf.data(), buf.size());
+    }
+
+    void deathTestTerminateHandler() {
+        reportToParent('T');
+        _exit(0);
+    }
+
+    [[noreturn]] void runDeathTestChild(const function<void()>& fn, bool catchTerminate) noexcept {
+        // Start from a clean slate: default signal handling, nothing blocked and no core files.
+        for (int sig = 1; sig < NSIG; ++sig) {
+            if (sig != SIGKILL && sig != SIGSTOP) {
+                signal(sig, SIG_DFL);
+            }
+        }
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigprocmask(SIG_SETMASK, &mask, nullptr);
+        struct rlimit noCoreFile { 0, 0 };
+        setrlimit(RLIMIT_CORE, &noCoreFile);
+
+        if (catchTerminate) {
+            set_terminate(deathTestTerminateHandler);
+        }
+        try {
+            fn();
+            reportToParent('R');
+        }
+        catch (const exception& e) {
+            reportToParent('E', _private::demangle(e) + ", what=" + e.what());
+        }
+        catch (...) {
+            reportToParent('E', "an unknown exception");
+        }
+        _exit(1);
+    }
+
+    // Run fn in a forked child process, killing it if it has not finished within the
+    // timeout. We never change the SIGCHLD handler, since other threads may be running
+    // death tests (or doing their own process management) at the same time.
+    DeathTestResult runDeathTest(const function<void()>& fn,
+                                 duration<double> timeout,
+                                 bool catchTerminate)
+    {
+        // The pipe is close-on-exec so that processes started by other threads do not
+        // inherit it, which would hold it open after the child has gone.
+        int fds[2];
+        errno = 0;
+#if defined(__linux__)
+        if (::pipe2(fds, O_CLOEXEC) == -1) {
+            throw system_error(errno, system_category(), "Failed to create the death test pipe");
+        }
+#else
+        if (::pipe(fds) == -1) {
+            throw system_error(errno, system_category(), "Failed to create the death test pipe");
+        }
+        (void) ::fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+        (void) ::fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+#endif
+        finally cleanup([&]{ ::close(fds[0]); });
+        (void) ::fcntl(fds[0], F_SETFL, O_NONBLOCK);
+
+        // Otherwise anything still buffered would be written by both processes.
+        fflush(nullptr);
+
+        const pid_t pid = ::fork();
+        if (pid == -1) {
+            const int err = errno;
+            ::close(fds[1]);
+            throw system_error(err, system_category(), "Failed to fork the death test");
+        }
+        if (pid == 0) {
+            ::close(fds[0]);
+            deathTestReportFd = fds[1];
+            runDeathTestChild(fn, catchTerminate);
+        }
+        ::close(fds[1]);
+
+        // Poll for the child, backing off so that quick deaths are noticed quickly
+        // without busy waiting on slow ones.
+        DeathTestResult result;
+        int status = 0;
+        const auto deadline = steady_clock::now() + duration_cast<steady_clock::duration>(timeout);
+        auto pause = microseconds(50);
+        while (true) {
+            const auto ret = ::waitpid(pid, &status, WNOHANG);
+            if (ret == pid) {
+                break;
+            }
+            if (ret == -1 && errno != EINTR) {
+                throw system_error(errno, system_category(),
+                                   "Failed to wait for the death test (is SIGCHLD ignored?)");
+            }
+            if (steady_clock::now() >= deadline) {
+                ::kill(pid, SIGKILL);
+                while (::waitpid(pid, &status, 0) == -1 && errno == EINTR) {}
+                result.outcome = DeathTestResult::Outcome::timedOut;
+                return result;
+            }
+            this_thread::sleep_for(pause);
+            pause = min(pause * 2, microseconds(10000));
+        }
+
+        string report;
+        char buf[1024];
+        while (true) {
+            const ssize_t n = ::read(fds[0], buf, sizeof(buf));
+            if (n > 0) {
+                report.append(buf, size_t(n));
+            }
+            else if (n == 0 || errno != EINTR) {
+                break;
+            }
+        }
+
+        if (!report.empty()) {
+            switch (report[0]) {
+                case 'T':
+                    result.outcome = DeathTestResult::Outcome::terminated;
+                    break;
+                case 'E':
+                    result.outcome = DeathTestResult::Outcome::threw;
+                    result.message = report.substr(1);
+                    break;
+                default:
+                    result.outcome = DeathTestResult::Outcome::returned;
+                    break;
+            }
+        }
+        else if (WIFSIGNALED(status)) {
+            result.outcome = DeathTestResult::Outcome::signalled;
+            result.value = WTERMSIG(status);
+        }
+        else {
+            result.outcome = DeathTestResult::Outcome::exited;
+            result.value = WEXITSTATUS(status);
+        }
+        return result;
+    }
+}
+
+
+// MARK: Assertions
+
+namespace {
+
+    // Time numberOfRuns calls of each of fnA and fnB, alternating which goes first, so that
+    // any drift in the speed of the machine (throttling, other load) affects both equally.
+    pair<vector<double>, vector<double>> timesOfInterleavedRuns(const function<void()>& fnA,
+                                                                const function<void()>& fnB,
+                                                                unsigned numberOfRuns)
+    {
+        CpuPin pin;
+        fnA();
+        fnB();
+
+        vector<double> timesA, timesB;
+        timesA.reserve(numberOfRuns);
+        timesB.reserve(numberOfRuns);
+        auto timeOf = [](const function<void()>& fn) {
+            prepareCachesForTiming();
+            return timeOfExecution(fn).count();
+        };
+        for (unsigned i = 0; i < numberOfRuns; ++i) {
+            if (i % 2 == 0) {
+                timesA.push_back(timeOf(fnA));
+                timesB.push_back(timeOf(fnB));
+            }
+            else {
+                timesB.push_back(timeOf(fnB));
+                timesA.push_back(timeOf(fnA));
+            }
+        }
+        return make_pair(move(timesA), move(timesB));
+    }
+
+    // Returns the one-sided p-value of the Mann-Whitney U test for the values of a tending
+    // to be smaller than those of b. This uses the normal approximation, which is good
+    // enough for the number of samples that we take.
+    double mannWhitneyPValue(const vector<double>& a, const vector<double>& b) {
+        double u = 0.0;
+        for (const auto x : a) {
+            for (const auto y : b) {
+                if (x < y) u += 1.0;
+                else if (x == y) u += 0.5;
+            }
+        }
+        const double n1 = double(a.size());
+        const double n2 = double(b.size());
+        const double mean = n1 * n2 / 2.0;
+        const double stddev = sqrt(n1 * n2 * (n1 + n2 + 1.0) / 12.0);
+        const double z = (u - mean - 0.5) / stddev;
+        return 0.5 * erfc(z / sqrt(2.0));
+    }
+
+    // Returns the given quantile (0 to 1) of sorted values.
+    double quantile(const vector<double>& sortedValues, double q) {
+        assert(!sortedValues.empty());
+        const double pos = q * double(sortedValues.size() - 1);
+        const auto i = size_t(pos);
+        if (i + 1 >= sortedValues.size()) {
+            return sortedValues.back();
+        }
+        return sortedValues[i] + (pos - double(i)) * (sortedValues[i+1] - sortedValues[i]);
+    }
+
+    // Describe a time, given in seconds, in the most readable unit.
+    string describeTime(double seconds) {
+        ostringstream strm;
+        strm << setprecision(3);
+        if (seconds < 1e-6)         strm << seconds * 1e9 << "ns";
+        else if (seconds < 1e-3)    strm << seconds * 1e6 << "us";
+        else if (seconds < 1.0)     strm << seconds * 1e3 << "ms";
+        else                        strm << seconds << "s";
+        return strm.str();
+    }
+
+    // Returns the name of a complexity class, as used in the reports.
+    const char* nameOfComplexity(Complexity c) noexcept {
+        switch (c) {
+            case Complexity::Constant:  return "Constant";
+            case Complexity::LogN:      return "LogN";
+            case Complexity::N:         return "N";
+            case Complexity::NLogN:     return "NLogN";
+            case Complexity::NSquared:  return "NSquared";
+            case Complexity::NCubed:    return "NCubed";
+        }
+        return "Unknown";
+    }
+
+    // Returns the growth function of a complexity class for the size n.
+    double growthOf(Complexity c, size_t n) noexcept {
+        const auto x = double(n);
+        switch (c) {
+            case Complexity::Constant:  return 1.0;
+            case Complexity::LogN:      return log2(x);
+            case Complexity::N:         return x;
+            case Complexity::NLogN:     return x * log2(x);
+            case Complexity::NSquared:  return x * x;
+            case Complexity::NCubed:    return x * x * x;
+        }
+        return 1.0;
+    }
+
+    // The least squares fit of times to coefficient * growthOf(complexity, size), along
+    // with the root mean square of the residuals. The residuals are relative to the times,
+    // so that every size counts equally rather than the fit being dominated by the largest
+    // (whose times are also the most affected by the memory hierarchy).
+    struct ComplexityFit {
+        Complexity  complexity;
+        double      coefficient = 0.0;
+        double      relativeRms = numeric_limits<double>::infinity();
+    };
+
+    ComplexityFit fitComplexity(Complexity c, const vector<size_t>& sizes, const vector<double>& times) {
+        ComplexityFit fit { c };
+        double sumGT = 0.0, sumGGTT = 0.0;
+        for (size_t i = 0; i < sizes.size(); ++i) {
+            if (!(times[i] > 0.0)) {
+                return fit;
+            }
+            const auto gt = growthOf(c, sizes[i]) / times[i];
+            sumGT += gt;
+            sumGGTT += gt * gt;
+        }
+        if (sumGGTT > 0.0) {
+            fit.coefficient = sumGT / sumGGTT;
+            double sumOfSquares = 0.0;
+            for (size_t i = 0; i < sizes.size(); ++i) {
+                const auto residual = 1.0 - fit.coefficient * growthOf(c, sizes[i]) / times[i];
+                sumOfSquares += residual * residual;
+            }
+            fit.relativeRms = sqrt(sumOfSquares / double(sizes.size()));
+        }
+        return fit;
+    }
+
+    // Describe a set of sorted times by their minimum, quartiles and maximum.
+    string describeTimes(const vector<double>& sortedTimes) {
+        return "min " + describeTime(sortedTimes.front())
+            + ", q1 " + describeTime(quantile(sortedTimes, 0.25))
+            + ", median " + describeTime(quantile(sortedTimes, 0.5))
+            + ", q3 " + describeTime(quantile(sortedTimes, 0.75))
+            + ", max " + describeTime(sortedTimes.back());
+    }
+}
+
+namespace kss { namespace test {
+
+    bool doesNotThrowException(const function<void()>& fn) {
+        bool caughtSomething = false;
+        try {
+            fn();
+        }
+        catch (const exception& e) {
+            caughtSomething = true;
+            _private::setFailureDetails("threw "
+                                        + _private::demangle(e)
+                                        + ", what=" + e.what());
+        }
+        return !caughtSomething;
+    }
+
+    bool throwsSystemErrorWithCategory(const error_category& cat, const function<void()>& fn) {
+        bool caughtCorrectCategory = false;
+        try {
+            fn();
+        }
+        catch (const system_error& e) {
+            caughtCorrectCategory = (e.code().category() == cat);
+            if (!caughtCorrectCategory) {
+                _private::setFailureDetails(string("actual category was ")
+                                            + e.code().category().name());
+            }
+        }
+        catch (const exception& e) {
+            _private::setFailureDetails("actually exception was "
+                                        + _private::demangle(e)
+                                        + ", what=" + e.what());
+        }
+        return caughtCorrectCategory;
+    }
+
+    bool throwsSystemErrorWithCode(const error_code& code, const function<void()>& fn) {
+        bool caughtCorrectCode = false;
+        try {
+            fn();
+        }
+        catch (const system_error& e) {
+            caughtCorrectCode = (e.code() == code);
+            if (!caughtCorrectCode) {
+                _private::setFailureDetails(string("actual code was ")
+                                            + to_string(e.code().value())
+                                            + ", category "
+                                            + e.code().category().name());
             }
         }
+        catch (const exception& e) {
+            _private::setFailureDetails("actually exception was "
+                                        + _private::demangle(e)
+                                        + ", what=" + e.what());
+        }
+        return caughtCorrectCode;
     }
 
-
-    struct FailureJsonGenerator
-    : public AbstractGenerator<pair<string, string>, json::simple_writer::node>
-    {
-        FailureJsonGenerator(const failures_t& failures) : AbstractGenerator(failures) {}
-        virtual ~FailureJsonGenerator() = default;
-
-        virtual void populate() override {
-            _n["message"] = _it->first;
-            if (!_it->second.empty()) {
-                _n["message"] += " (" + _it->second + ")";
+    bool instructionsPerCallBelow(uint64_t maxInstructions, const function<void()>& fn, unsigned numberOfCalls) {
+        fn();
+        const auto count = countInstructions([&]{
+            for (unsigned i = 0; i < numberOfCalls; ++i) {
+                fn();
             }
+        });
+        if (!count) {
+            static atomic<bool> hasWarned { false };
+            if (!isQuietMode && !hasWarned.exchange(true)) {
+                cerr << endl << "Warning: there is no instruction counter, so instructionsPerCallBelow "
+                    << "passes without checking." << endl;
+            }
+            return true;
         }
-    };
-
-    struct TestCaseJsonGenerator : public AbstractGenerator<TestCaseWrapper, json::simple_writer::node> {
-        TestCaseJsonGenerator(const vector<TestCaseWrapper>& tests) : AbstractGenerator(tests) {}
-        virtual ~TestCaseJsonGenerator() = default;
 
-        virtual void populate() override {
-            _n["name"] = _it->name;
-            _n["status"] = (_it->skipped ? "NOTRUN" : "RUN");
-            _n["time"] = to_string(_it->durationOfTest.count());
-            _n["classname"] = (_it->owner ? _private::demangle(*(_it->owner)) : string("none"));
-            if (!_it->failures.empty()) {
-                _n.arrays = { make_pair("failures", FailureJsonGenerator(_it->failures)) };
-            }
+        const auto perCall = *count / max(numberOfCalls, 1U);
+        if (perCall >= maxInstructions) {
+            _private::setFailureDetails("actually " + to_string(perCall) + " instructions per call");
+            return false;
         }
-    };
+        return true;
+    }
 
-    struct TestSuiteJsonGenerator : public AbstractGenerator<TestSuiteWrapper, json::simple_writer::node> {
-        TestSuiteJsonGenerator(const vector<TestSuiteWrapper>& suites) : AbstractGenerator(suites) {}
-        virtual ~TestSuiteJsonGenerator() = default;
+    bool instructionCountersAvailable() noexcept {
+        static const bool isAvailable = countInstructions([]{}).has_value();
+        return isAvailable;
+    }
 
-        virtual void populate() override {
-            _n["name"] = _it->suite->name();
-            _n["tests"] = to_string(_it->suite->_implementation()->tests.size());
-            _n["failures"] = to_string(_it->numberOfFailedTests);
-            _n["errors"] = to_string(_it->numberOfErrors);
-            _n["time"] = to_string(_it->durationOfTestSuite.count());
-            _n.arrays = { make_pair("testsuite", TestCaseJsonGenerator(_it->suite->_implementation()->tests)) };
+    bool isFasterThan(const function<void()>& fnA, const function<void()>& fnB,
+                      double minSpeedup, unsigned numberOfRuns)
+    {
+        if (!(minSpeedup > 0.0)) {
+            throw invalid_argument("isFasterThan: minSpeedup must be positive");
+        }
+        if (numberOfRuns < 2) {
+            throw invalid_argument("isFasterThan: numberOfRuns must be at least 2");
         }
-    };
 
-    void writeJsonReportToStream(ostream& strm) {
-        json::simple_writer::node n;
-        n["tests"] = to_string(reportSummary.numberOfTests);
-        n["failures"] = to_string(reportSummary.numberOfFailures);
-        n["errors"] = to_string(reportSummary.numberOfErrors);
-        n["time"] = to_string(reportSummary.durationOfTestRun.count());
-        n["timestamp"] = reportSummary.timeOfTestRun;
-        n["name"] = reportSummary.nameOfTestRun;
-        const auto* suites = testSuites();
-        n.arrays = { make_pair("testsuites", TestSuiteJsonGenerator(*suites)) };
-        json::simple_writer::write(strm, n);
+        auto [timesA, timesB] = timesOfInterleavedRuns(fnA, fnB, numberOfRuns);
+        vector<double> scaledTimesA;
+        scaledTimesA.reserve(timesA.size());
+        for (const auto t : timesA) {
+            scaledTimesA.push_back(t * minSpeedup);
+        }
+        const auto p = mannWhitneyPValue(scaledTimesA, timesB);
+        if (p >= significanceLevel) {
+            sort(timesA.begin(), timesA.end());
+            sort(timesB.begin(), timesB.end());
+            ostringstream strm;
+            strm << setprecision(3)
+                << "fnA " << describeTimes(timesA) << "; fnB " << describeTimes(timesB)
+                << "; median speedup " << quantile(timesB, 0.5) / quantile(timesA, 0.5)
+                << "x, needed " << minSpeedup << "x (p=" << p << ", " << numberOfRuns << " runs)";
+            _private::setFailureDetails(strm.str());
+            return false;
+        }
+        return true;
     }
 
-    void printJsonReport() {
-        if (jsonReportFilename == "-") {
-            if (!isQuietMode || xmlReportFilename == "-") {
-                cout << "==JSON=REPORT==================================" << endl;
-            }
-            writeJsonReportToStream(cout);
+    vector<size_t> geometricSizes(size_t first, size_t last, double factor) {
+        if (first == 0 || last < first || !(factor > 1.0)) {
+            throw invalid_argument("geometricSizes: requires 0 < first <= last and factor > 1");
         }
-        else {
-            write_file(jsonReportFilename, [&](ofstream& strm) {
-                writeJsonReportToStream(strm);
-            });
-            if (!isQuietMode) {
-                cout << "  Wrote JSON report to " << jsonReportFilename << endl;
+        vector<size_t> sizes;
+        for (double size = double(first); size <= double(last); size *= factor) {
+            const auto n = size_t(llround(size));
+            if (sizes.empty() || n > sizes.back()) {
+                sizes.push_back(n);
             }
         }
+        return sizes;
     }
 
-    void printTestRunSummary() {
-        if (!isQuietMode) {
-            outputStandardSummary();
+    bool terminates(const function<void()>& fn, duration<double> timeout) {
+        const auto result = runDeathTest(fn, timeout, true);
+        if (result.outcome == DeathTestResult::Outcome::terminated) {
+            return true;
         }
-        if (!xmlReportFilename.empty()) {
-            printXmlReport();
-        }
-        if (!jsonReportFilename.empty()) {
-            printJsonReport();
+        _private::setFailureDetails(result.describe(timeout));
+        return false;
+    }
+
+    bool exitsWith(int exitCode, const function<void()>& fn, duration<double> timeout) {
+        const auto result = runDeathTest(fn, timeout, false);
+        if (result.outcome == DeathTestResult::Outcome::exited && result.value == (exitCode & 0xff)) {
+            return true;
         }
+        _private::setFailureDetails(result.describe(timeout));
+        return false;
     }
 
-    void printTestSuiteHeader(const TestSuite& ts) {
-        if (isVerboseMode) {
-            cout << "  " << ts.name() << endl;
+    bool killedBySignal(int signalNumber, const function<void()>& fn, duration<double> timeout) {
+        const auto result = runDeathTest(fn, timeout, false);
+        if (result.outcome == DeathTestResult::Outcome::signalled && result.value == signalNumber) {
+            return true;
         }
+        _private::setFailureDetails(result.describe(timeout));
+        return false;
     }
+}}
 
-    void printTestSuiteSummary(const TestSuiteWrapper& w) {
-        if (!isQuietMode) {
-            const auto* impl = w.suite->_implementation();
-            if (isVerboseMode) {
-                unsigned numberOfAssertions = 0;
-                for (const auto& t : impl->tests) {
-                    numberOfAssertions += t.assertions;
-                }
 
-                if (!w.numberOfErrors && !w.numberOfFailedAssertions) {
-                    cout << "    PASSED all " << numberOfAssertions << " checks";
-                }
-                else {
-                    cout << "    Passed " << numberOfAssertions << " checks";
-                }
+// MARK: Golden Files
 
-                if (w.numberOfSkippedTests > 0) {
-                    cout << ", " << w.numberOfSkippedTests << " test " << (w.numberOfSkippedTests == 1 ? "case" : "cases") << " SKIPPED";
-                }
-                if (w.numberOfErrors > 0) {
-                    cout << ", " << w.numberOfErrors << (w.numberOfErrors == 1 ? " error" : " errors");
-                }
-                if (w.numberOfFailedAssertions > 0) {
-                    cout << ", " << w.numberOfFailedAssertions << " FAILED";
-                }
-                cout << "." << endl;
+namespace {
 
-                if (w.numberOfErrors > 0) {
-                    cout << "    Errors:" << endl;
-                    for (const auto& t : impl->tests) {
-                        for (const auto& err : t.errors) {
-                            cout << "      " << string(err) << endl;
-                        }
-                    }
-                }
-                if (w.numberOfFailedAssertions > 0) {
-                    cout << "    Failures:" << endl;
-                    for (const auto& t : impl->tests) {
-                        for (const auto& f : t.failures) {
-                            cout << "      " << f.first << endl;
-                            if (!f.second.empty()) {
-                                cout << "         ↳" << f.second << endl;
-                            }
-                        }
-                    }
-                }
-            }
-            else {
-                cout << impl->result();
+    // Returns the index of the first byte that differs between a and b, both of which
+    // must be at least n bytes, or n if they are identical.
+    size_t firstDifference(const char* a, const char* b, size_t n) noexcept {
+        size_t offset = 0;
+        while (n > 0) {
+            const auto len = min(n, goldenBlockSize);
+            if (memcmp(a, b, len) != 0) {
+                return offset + size_t(mismatch(a, a + len, b).first - a);
             }
+            a += len;
+            b += len;
+            offset += len;
+            n -= len;
         }
+        return offset;
     }
 
-    void printTestCaseHeader(const TestCaseWrapper& t) {
-        if (isVerboseMode) {
-            cout << "    " << t.name << " ";
+    bool looksLikeText(string_view s) noexcept {
+        for (const auto c : s) {
+            const auto uc = static_cast<unsigned char>(c);
+            if (uc < 0x20 && c != '\n' && c != '\r' && c != '\t') {
+                return false;
+            }
         }
+        return true;
     }
 
-    void printTestCaseSummary(const TestCaseWrapper& t) {
-        if (isVerboseMode) {
-            cout << endl;
+    string asText(string_view s) {
+        string ret = "\"";
+        for (const auto c : s) {
+            switch (c) {
+                case '\n': ret += "\\n"; break;
+                case '\r': ret += "\\r"; break;
+                case '\t': ret += "\\t"; break;
+                case '"':  ret += "\\\""; break;
+                case '\\': ret += "\\\\"; break;
+                default:   ret += c; break;
+            }
         }
+        return ret + "\"";
     }
 
-    int testResultCode() {
-        if (reportSummary.numberOfErrors > 0) {
-            return -1;
+    string asHex(string_view s) {
+        ostringstream strm;
+        strm << "[" << hex << setfill('0');
+        for (size_t i = 0; i < s.size(); ++i) {
+            strm << (i > 0 ? " " : "") << setw(2) << unsigned(static_cast<unsigned char>(s[i]));
         }
-        return reportSummary.numberOfFailures;
+        strm << "]";
+        return strm.str();
     }
 
-    void runTestSuite(TestSuiteWrapper* wrapper) {
-        if (!passesFilter(*wrapper->suite)) {
-            wrapper->filteredOut = true;
-            return;
+    // Describe where actual first differs from golden. Everything before offset is known
+    // to be the same in both, actualAfter is what actual has from offset onwards (at
+    // least as much of it as we have).
+    string describeGoldenDifference(const string& goldenFilename,
+                                    string_view golden,
+                                    size_t offset,
+                                    string_view actualAfter,
+                                    size_t actualSize)
+    {
+        const auto windowStart = offset - min(offset, goldenContextSize);
+        const auto before = golden.substr(windowStart, offset - windowStart);
+        const auto expectedAfter = golden.substr(min(offset, golden.size()), goldenContextSize);
+        actualAfter = actualAfter.substr(0, goldenContextSize);
+
+        ostringstream strm;
+        strm << "differs from " << goldenFilename << " at offset " << offset;
+        const bool isText = looksLikeText(before)
+            && looksLikeText(expectedAfter)
+            && looksLikeText(actualAfter);
+        if (isText) {
+            strm << " (line " << (1 + count(golden.begin(), golden.begin() + offset, '\n')) << ")";
+        }
+        if (golden.size() != actualSize) {
+            strm << ", expected " << golden.size() << " bytes, actual was " << actualSize;
         }
 
-        wrapper->timestamp = now();
-        printTestSuiteHeader(*wrapper->suite);
-        auto* impl = wrapper->suite->_implementation();
-        impl->addBeforeAndAfterAll();
-        currentSuite = wrapper;
-
-        wrapper->durationOfTestSuite = timeOfExecution([&]{
-            for (auto& t : impl->tests) {
-                printTestCaseHeader(t);
-                impl->runTestCase(t);
-                printTestCaseSummary(t);
-            }
-        });
-
-        currentSuite = nullptr;
-        printTestSuiteSummary(*wrapper);
+        auto fmt = (isText ? asText : asHex);
+        strm << ", after " << (windowStart > 0 ? "..." : "") << fmt(before)
+            << " expected " << fmt(expectedAfter)
+            << (offset + expectedAfter.size() < golden.size() ? "..." : "")
+            << " actual was " << fmt(actualAfter)
+            << (offset + actualAfter.size() < actualSize ? "..." : "");
+        return strm.str();
+    }
 
-        if (stopOnFirstFailure) {
-            if (wrapper->numberOfErrors > 0 || wrapper->numberOfFailedTests > 0) {
-                if (!isVerboseMode) {
-                    cerr << endl;
-                }
-                cerr << "Early termination requested, exiting." << endl;
-                exit(wrapper->numberOfErrors + wrapper->numberOfFailedTests);
-            }
+    // Map the golden file, or set the failure details and return null if it does not exist.
+    unique_ptr<MappedFile> mapGoldenFile(const string& goldenFilename) {
+        if (!exists(goldenFilename)) {
+            _private::setFailureDetails(goldenFilename
+                                        + " does not exist, run with --update-golden to create it");
+            return nullptr;
         }
+        auto golden = make_unique<MappedFile>(goldenFilename);
+        golden->advise(MADV_SEQUENTIAL);
+        return golden;
     }
 }
 
+namespace kss { namespace test {
 
-namespace kss::test {
+    bool matchesGoldenFile(const string& goldenFilename, string_view actual) {
+        if (updateGoldenFiles) {
+            write_file_atomically(goldenFilename, [&](ofstream& strm) {
+                strm.write(actual.data(), streamsize(actual.size()));
+            });
+            return true;
+        }
 
-    int run(string_view testRunName, int argc, const char *const *argv) {
-        auto* suites = testSuites();
-        reportSummary.programName = path(argv[0]).filename();
-        reportSummary.nameOfTestRun = testRunName;
-        reportSummary.nameOfHost = hostname();
-        if (parseCommandLine(argc, argv)) {
-            printTestRunHeader();
+        const auto golden = mapGoldenFile(goldenFilename);
+        if (!golden) {
+            return false;
+        }
 
-            sort(suites->begin(), suites->end());
-            reportSummary.timeOfTestRun = now();
-            reportSummary.durationOfTestRun = timeOfExecution([&]{
-                vector<future<bool>> futures;
+        const auto n = min(golden->size(), actual.size());
+        const auto offset = firstDifference(golden->data(), actual.data(), n);
+        if (offset == n && golden->size() == actual.size()) {
+            return true;
+        }
+        _private::setFailureDetails(describeGoldenDifference(goldenFilename,
+                                                             golden->view(),
+                                                             offset,
+                                                             actual.substr(offset),
+                                                             actual.size()));
+        return false;
+    }
 
-                for (auto& ts : *suites) {
-                    if (!isParallel || as<MustNotBeParallel>(ts.suite)) {
-                        runTestSuite(&ts);
-                    }
-                    else {
-                        TestSuiteWrapper* tsw = &ts;
-                        futures.push_back(async([tsw]{
-                            runTestSuite(tsw);
-                            return true;
-                        }));
-                    }
+    bool matchesGoldenFile(const string& goldenFilename, istream& actual) {
+        if (updateGoldenFiles) {
+            write_file_atomically(goldenFilename, [&](ofstream& strm) {
+                vector<char> buffer(goldenBlockSize);
+                while (actual.read(buffer.data(), streamsize(buffer.size())) || actual.gcount() > 0) {
+                    strm.write(buffer.data(), actual.gcount());
                 }
+            });
+            return true;
+        }
 
-                if (!futures.empty()) {
-                    for (auto& fut : futures) {
-                        fut.get();
-                    }
+        const auto golden = mapGoldenFile(goldenFilename);
+        if (!golden) {
+            return false;
+        }
+
+        // Compare a block at a time. The buffer has room past the block so that we can
+        // read a little more to show what follows a difference.
+        const auto g = golden->view();
+        vector<char> buffer(goldenBlockSize + goldenContextSize);
+        size_t offset = 0;
+        while (true) {
+            actual.read(buffer.data(), streamsize(goldenBlockSize));
+            auto n = size_t(actual.gcount());
+            const auto available = g.size() - min(offset, g.size());
+            const auto len = min(n, available);
+            const auto i = firstDifference(g.data() + offset, buffer.data(), len);
+            if (i < len || n > available || (n < goldenBlockSize && offset + n < g.size())) {
+                // Found the difference. Read the rest of the stream to learn its size.
+                if (n == goldenBlockSize) {
+                    actual.read(buffer.data() + n, streamsize(goldenContextSize));
+                    n += size_t(actual.gcount());
                 }
-            });
+                auto actualSize = offset + n;
+                while (actual.ignore(streamsize(goldenBlockSize))) {
+                    actualSize += size_t(actual.gcount());
+                }
+                actualSize += size_t(actual.gcount());
+                if (actual.bad()) {
+                    throw runtime_error("Failed while reading the actual contents for "
+                                        + goldenFilename);
+                }
+                _private::setFailureDetails(describeGoldenDifference(goldenFilename,
+                                                                     g,
+                                                                     offset + i,
+                                                                     string_view(buffer.data() + i, n - i),
+                                                                     actualSize));
+                return false;
+            }
+            offset += n;
+            if (n < goldenBlockSize) {
+                break;
+            }
+        }
 
-            printTestRunSummary();
+        if (actual.bad()) {
+            throw runtime_error("Failed while reading the actual contents for " + goldenFilename);
         }
-        delete suites;
-        return testResultCode();
+        return true;
     }
+}}
 
-    void skip() {
-        throw SkipTestCase();
-    }
 
-    bool isQuiet() noexcept {
-        return isQuietMode;
-    }
+// MARK: Fixture Files
 
-    bool isVerbose() noexcept {
-        return isVerboseMode;
-    }
+struct FixtureFile::Impl {
+    string      path;
+    MappedFile  file;
+
+    explicit Impl(const string& canonicalPath) : path(canonicalPath), file(canonicalPath) {}
+};
+
+FixtureFile::FixtureFile(unique_ptr<Impl> impl) noexcept : _impl(move(impl)) {}
+FixtureFile::~FixtureFile() noexcept {}
+
+const string& FixtureFile::path() const noexcept {
+    return _impl->path;
 }
 
+const char* FixtureFile::data() const noexcept {
+    return _impl->file.data();
+}
 
-// MARK: Assertions
+size_t FixtureFile::size() const noexcept {
+    return _impl->file.size();
+}
 
 namespace kss { namespace test {
 
-    bool doesNotThrowException(const function<void()>& fn) {
-        bool caughtSomething = false;
-        try {
-            fn();
-        }
-        catch (const exception& e) {
-            caughtSomething = true;
-            _private::setFailureDetails("threw "
-                                        + _private::demangle(e)
-                                        + ", what=" + e.what());
-        }
-        return !caughtSomething;
-    }
+    shared_ptr<const FixtureFile> fixtureFile(const string& path, bool prefetch) {
+        // The files that are currently mapped, by canonical path. The registry is leaked
+        // so that suites may still release their files while the process exits.
+        static mutex& lock = *new mutex();
+        static auto& files = *new map<string, weak_ptr<const FixtureFile>>();
 
-    bool throwsSystemErrorWithCategory(const error_category& cat, const function<void()>& fn) {
-        bool caughtCorrectCategory = false;
-        try {
-            fn();
+        error_code ec;
+        auto canonicalPath = weakly_canonical(path, ec).string();
+        if (ec) {
+            canonicalPath = path;
         }
-        catch (const system_error& e) {
-            caughtCorrectCategory = (e.code().category() == cat);
-            if (!caughtCorrectCategory) {
-                _private::setFailureDetails(string("actual category was ")
-                                            + e.code().category().name());
+
+        shared_ptr<const FixtureFile> fixture;
+        {
+            lock_guard<mutex> l(lock);
+            auto& entry = files[canonicalPath];
+            fixture = entry.lock();
+            if (!fixture) {
+                try {
+                    fixture.reset(new FixtureFile(make_unique<FixtureFile::Impl>(canonicalPath)));
+                }
+                catch (...) {
+                    files.erase(canonicalPath);
+                    throw;
+                }
+                entry = fixture;
+            }
+
+            // Forget the files that are no longer used.
+            for (auto it = files.begin(); it != files.end(); ) {
+                it = (it->second.expired() ? files.erase(it) : next(it));
             }
         }
-        catch (const exception& e) {
-            _private::setFailureDetails("actually exception was "
-                                        + _private::demangle(e)
-                                        + ", what=" + e.what());
-        }
-        return caughtCorrectCategory;
-    }
 
-    bool throwsSystemErrorWithCode(const error_code& code, const function<void()>& fn) {
-        bool caughtCorrectCode = false;
-        try {
-            fn();
+        if (prefetch) {
+            fixture->_impl->file.advise(MADV_WILLNEED);
         }
-        catch (const system_error& e) {
-            caughtCorrectCode = (e.code() == code);
-            if (!caughtCorrectCode) {
-                _private::setFailureDetails(string("actual code was ")
-                                            + to_string(e.code().value())
-                                            + ", category "
-                                            + e.code().category().name());
+        return fixture;
+    }
+
+    string hashOfFiles(const vector<string>& filenames) {
+        // 64 bit FNV-1a of the sizes and contents of the files.
+        uint64_t hash = 0xcbf29ce484222325ULL;
+        auto add = [&hash](const char* data, size_t n) {
+            for (size_t i = 0; i < n; ++i) {
+                hash = (hash ^ uint64_t((unsigned char)data[i])) * 0x100000001b3ULL;
             }
+        };
+        for (const auto& filename : filenames) {
+            const MappedFile file(filename);
+            file.advise(MADV_SEQUENTIAL);
+            const auto size = uint64_t(file.size());
+            add(reinterpret_cast<const char*>(&size), sizeof(size));
+            add(file.data(), file.size());
         }
-        catch (const exception& e) {
-            _private::setFailureDetails("actually exception was "
-                                        + _private::demangle(e)
-                                        + ", what=" + e.what());
-        }
-        return caughtCorrectCode;
+
+        ostringstream strm;
+        strm << hex << setw(16) << setfill('0') << hash;
+        return strm.str();
     }
+} }
 
-    bool terminates(const function<void()>& fn) {
-        // Need to ignore SIGCHLD for this test to work. We restore after the test. For some
-        // reason we need to specify an empty signal handler and not just SIG_IGN.
-        sig_t oldHandler = signal(SIGCHLD, my_signal_handler);
+namespace {
 
-        // In the child process we set a terminate handler that will exit the process with a 0.
-        if (pid_t pid = fork(); pid == 0) {
-            for (int i = 1; i <= 255; ++i) {
-                signal(i, my_signal_handler);
-            }
-            set_terminate(my_terminate_handler);
-            try {
-                fn();
-            }
-            catch (...) {
-                _exit(2);   // Error, an exception was thrown that did not cause a terminate().
-            }
-            _exit(1);       // Error, lambda exited without causing a terminate().
+    // Returns the cache file of a fixture. The '@' cannot appear in either part, since
+    // both are escaped, hence it separates the key from the hash.
+    path cachedFixturePath(const string& key, string_view inputsHash) {
+        const auto directory = (fixtureCacheDirectory.empty()
+                                ? temp_directory_path() / "ksstest-fixture-cache"
+                                : path(fixtureCacheDirectory));
+        return directory / (fileSafeEscaped(key) + "@" + fileSafeEscaped(string(inputsHash)) + ".cache");
+    }
+}
+
+namespace kss { namespace test { namespace _private {
+
+    unique_lock<mutex> lockCachedFixture(const string& key) {
+        static mutex& lock = *new mutex();
+        static auto& locks = *new map<string, mutex>();
+        lock_guard<mutex> l(lock);
+        return unique_lock<mutex>(locks[key]);
+    }
+
+    shared_ptr<const FixtureFile> findCachedFixture(const string& key, string_view inputsHash) {
+        const auto filename = cachedFixturePath(key, inputsHash);
+        error_code ec;
+        if (!exists(filename, ec)) {
+            return nullptr;
         }
+        return fixtureFile(filename.string());
+    }
 
-        // In the parent process we wait for the child to exit, then see if it exited with
-        // a 0 status.
-        else {
-            int status = -9;    // Any non-zero state.
-            waitpid(pid, &status, 0);
-            signal(SIGCHLD, oldHandler);
-            if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
-                return true;   // success
-            return false;       // failure
+    void storeCachedFixture(const string& key, string_view inputsHash,
+                            const function<void(ostream&)>& serialize)
+    {
+        const auto filename = cachedFixturePath(key, inputsHash);
+        write_file_atomically(filename.string(), [&](ofstream& strm) { serialize(strm); });
+
+        // Remove the files of the fixture built from other inputs, which are now stale.
+        const auto prefix = fileSafeEscaped(key) + "@";
+        error_code ec;
+        for (const auto& entry : directory_iterator(filename.parent_path(), ec)) {
+            const auto name = entry.path().filename().string();
+            if (starts_with(name, prefix) && entry.path().extension() == ".cache"
+                && entry.path() != filename)
+            {
+                std::filesystem::remove(entry.path(), ec);
+            }
         }
     }
-}}
+} } }
 
 
 // MARK: TestSuite Implementation
@@ -1448,7 +5301,390 @@ TestSuite::test_case_context_t TestSuite::testCaseContext() const noexcept {
 
 void TestSuite::setTestCaseContext(test_case_context_t ctx) noexcept {
     assert(ctx != nullptr);             // User must not set a null value.
-    currentTest = static_cast<TestCaseWrapper*>(ctx);
+    (void) _private::exchangeTestCaseContext(ctx);
+}
+
+
+// MARK: Data Driven Test Suites
+
+namespace {
+
+    // Split a CSV record into its fields, stopping after the first maxFields of them.
+    // Fields may be quoted, in which case they may contain commas, and quotes are escaped
+    // by doubling them.
+    vector<string> parseCsvRecord(string_view record, size_t maxFields = SIZE_MAX) {
+        vector<string> fields;
+        string field;
+        bool inQuotes = false;
+        for (size_t i = 0; i < record.size(); ++i) {
+            const auto ch = record[i];
+            if (inQuotes) {
+                if (ch != '"') {
+                    field += ch;
+                }
+                else if (i + 1 < record.size() && record[i+1] == '"') {
+                    field += '"';
+                    ++i;
+                }
+                else {
+                    inQuotes = false;
+                }
+            }
+            else if (ch == '"') {
+                inQuotes = true;
+            }
+            else if (ch == ',') {
+                fields.push_back(move(field));
+                if (fields.size() == maxFields) {
+                    return fields;
+                }
+                field.clear();
+            }
+            else {
+                field += ch;
+            }
+        }
+        fields.push_back(move(field));
+        return fields;
+    }
+
+    // A memory mapped data file split into rows, which are only parsed when needed.
+    class DataFile {
+    public:
+        explicit DataFile(const string& filename) : _file(filename) {
+            const auto extension = path(filename).extension().string();
+            if (extension == ".csv") {
+                _isCsv = true;
+            }
+            else if (extension != ".jsonl" && extension != ".ndjson") {
+                throw invalid_argument(filename + " is not a .csv, .jsonl or .ndjson file");
+            }
+
+            // Split into lines, other than the line breaks within quoted CSV fields, keeping
+            // the line of the file on which each row starts.
+            const auto contents = _file.view();
+            bool inQuotes = false;
+            size_t start = 0;
+            size_t lineNumber = 1;
+            for (size_t i = 0; i <= contents.size(); ++i) {
+                if (i < contents.size()) {
+                    if (_isCsv && contents[i] == '"') {
+                        inQuotes = !inQuotes;
+                    }
+                    if (contents[i] != '\n' || inQuotes) {
+                        continue;
+                    }
+                }
+                auto row = contents.substr(start, i - start);
+                if (!row.empty() && row.back() == '\r') {
+                    row.remove_suffix(1);
+                }
+                if (row.find_first_not_of(" \t") != string_view::npos) {
+                    _rows.push_back(row);
+                    _lineNumbers.push_back(lineNumber);
+                }
+                lineNumber += 1 + size_t(count(row.begin(), row.end(), '\n'));
+                start = i + 1;
+            }
+
+            if (_isCsv && !_rows.empty()) {
+                _columns = parseCsvRecord(_rows.front());
+                _rows.erase(_rows.begin());
+                _lineNumbers.erase(_lineNumbers.begin());
+            }
+        }
+
+        size_t numberOfRows() const noexcept { return _rows.size(); }
+
+        // Parse the i'th row (counting from 0).
+        DataRow row(size_t i) const {
+            map<string, string> values;
+            if (_isCsv) {
+                auto fields = parseCsvRecord(_rows[i]);
+                for (size_t c = 0; c < fields.size() && c < _columns.size(); ++c) {
+                    values[_columns[c]] = move(fields[c]);
+                }
+            }
+            else {
+                values = json::simple_reader::read(string(_rows[i])).attributes;
+            }
+            return DataRow(_lineNumbers[i], _rows[i], move(values));
+        }
+
+        // Returns the name of the i'th row: the value of its key column, if it has one,
+        // otherwise the line of the file it starts on. Only as much of the row as is needed to find the key
+        // is parsed.
+        string nameOfRow(size_t i, const string& keyColumn) const {
+            if (!keyColumn.empty()) {
+                try {
+                    string name;
+                    if (_isCsv) {
+                        const auto column = find(_columns.begin(), _columns.end(), keyColumn);
+                        const auto c = size_t(column - _columns.begin());
+                        if (column != _columns.end()) {
+                            auto fields = parseCsvRecord(_rows[i], c + 1);
+                            if (fields.size() > c) {
+                                name = move(fields[c]);
+                            }
+                        }
+                    }
+                    else {
+                        name = json::simple_reader::readAttribute(string(_rows[i]), keyColumn).value_or(string());
+                    }
+                    if (!name.empty()) {
+                        return name;
+                    }
+                }
+                catch (const invalid_argument&) {
+                    // Malformed rows are reported when their test case is run.
+                }
+            }
+            return "row " + to_string(_lineNumbers[i]);
+        }
+
+    private:
+        MappedFile          _file;
+        bool                _isCsv = false;
+        vector<string>      _columns;
+        vector<string_view> _rows;
+        vector<size_t>      _lineNumbers;
+    };
+}
+
+DataDrivenTestSuite::DataDrivenTestSuite(const string& testSuiteName,
+                                         const string& filename,
+                                         const string& keyColumn,
+                                         row_fn fn,
+                                         size_t rowsPerCase)
+: TestSuite(testSuiteName, {})
+{
+    if (rowsPerCase == 0) {
+        throw invalid_argument("DataDrivenTestSuite: rowsPerCase must be positive");
+    }
+
+    auto* impl = _implementation();
+    impl->mayRunTestCasesInParallel = true;
+    impl->createTestCases = [this, filename, keyColumn, fn, rowsPerCase](vector<TestCaseWrapper>& tests) {
+        shared_ptr<const DataFile> file;
+        try {
+            file = make_shared<const DataFile>(filename);
+        }
+        catch (...) {
+            TestCaseWrapper wrapper;
+            wrapper.owner = this;
+            wrapper.name = filename;
+            wrapper.fn = [error = current_exception()] { rethrow_exception(error); };
+            tests.push_back(move(wrapper));
+            return;
+        }
+
+        const auto n = file->numberOfRows();
+        tests.reserve(tests.size() + (n + rowsPerCase - 1) / rowsPerCase);
+        for (size_t first = 0; first < n; first += rowsPerCase) {
+            const auto last = min(n, first + rowsPerCase);
+            TestCaseWrapper wrapper;
+            wrapper.owner = this;
+            wrapper.name = file->nameOfRow(first, keyColumn);
+            if (last - first > 1) {
+                wrapper.name += " to " + file->nameOfRow(last - 1, keyColumn);
+            }
+            wrapper.fn = [file, fn, first, last] {
+                for (auto i = first; i < last; ++i) {
+                    fn(file->row(i));
+                }
+            };
+            tests.push_back(move(wrapper));
+        }
+    };
+}
+
+
+// MARK: Floating point comparison
+
+namespace {
+
+    // The integer type of the same size as F, used to compute ulp distances.
+    template <class F> struct FloatTraits;
+    template <> struct FloatTraits<float> { using int_t = int32_t; };
+    template <> struct FloatTraits<double> { using int_t = int64_t; };
+
+    // Map the bits of a float onto integers that are ordered the same way as the floats
+    // themselves, so that the ulp distance is the difference of the integers. (Both
+    // zeros map to 0.)
+    template <class F>
+    inline typename FloatTraits<F>::int_t orderedBits(F f) noexcept {
+        using int_t = typename FloatTraits<F>::int_t;
+        int_t i;
+        memcpy(&i, &f, sizeof(i));
+        return (i < 0 ? int_t(numeric_limits<int_t>::min() - i) : i);
+    }
+
+    // The distance is kept in the unsigned type of the same size as F, since widening
+    // it would prevent the comparisons of floats from being vectorized.
+    template <class F>
+    inline auto ulpDistance(F a, F b) noexcept {
+        using uint_t = make_unsigned_t<typename FloatTraits<F>::int_t>;
+        const auto oa = orderedBits(a);
+        const auto ob = orderedBits(b);
+        return (oa > ob ? uint_t(uint_t(oa) - uint_t(ob)) : uint_t(uint_t(ob) - uint_t(oa)));
+    }
+
+    // The tolerance converted to the type being compared.
+    template <class F>
+    struct TypedTolerance {
+        using ulps_t = decltype(ulpDistance(F(), F()));
+
+        F       absolute;
+        F       relative;
+        ulps_t  ulps;
+
+        explicit TypedTolerance(const FloatTolerance& t) noexcept
+        : absolute(F(t.absolute)),
+          relative(F(t.relative)),
+          ulps(ulps_t(min<uint64_t>(t.ulps, numeric_limits<ulps_t>::max())))
+        {}
+    };
+
+    // Written without branches (or calls) so that the loops calling it can be vectorized.
+    template <class F>
+    inline bool isClose(F e, F a, const TypedTolerance<F>& tolerance) noexcept {
+        const F absE = std::abs(e);
+        const F absA = std::abs(a);
+        const F err = std::abs(e - a);
+        const bool finite = (absE <= numeric_limits<F>::max()) & (absA <= numeric_limits<F>::max());
+        const bool close = (err <= tolerance.absolute)
+            | (err <= tolerance.relative * (absE > absA ? absE : absA))
+            | (ulpDistance(e, a) <= tolerance.ulps);
+        const bool same = (e == a) | ((e != e) & (a != a));
+        return (finite & close) | ((!finite) & same);
+    }
+
+    // Summary of the errors over an entire pair of arrays. The histogram counts the
+    // ulp errors in power of two buckets: bucket 0 is exact, bucket k (1..64) holds
+    // errors in [2^(k-1), 2^k), and the final bucket holds the NaN/infinity mismatches.
+    struct FloatErrorSummary {
+        double                  maxAbsError = 0.0;
+        size_t                  maxAbsErrorIndex = 0;
+        uint64_t                maxUlpError = 0;
+        size_t                  maxUlpErrorIndex = 0;
+        array<size_t, 66>       histogram {};
+
+        void merge(const FloatErrorSummary& rhs) noexcept {
+            if (rhs.maxAbsError > maxAbsError) {
+                maxAbsError = rhs.maxAbsError;
+                maxAbsErrorIndex = rhs.maxAbsErrorIndex;
+            }
+            if (rhs.maxUlpError > maxUlpError) {
+                maxUlpError = rhs.maxUlpError;
+                maxUlpErrorIndex = rhs.maxUlpErrorIndex;
+            }
+            for (size_t i = 0; i < histogram.size(); ++i) {
+                histogram[i] += rhs.histogram[i];
+            }
+        }
+    };
+
+    string histogramBucketName(size_t bucket) {
+        if (bucket == 0) { return "0"; }
+        if (bucket == 1) { return "1"; }
+        if (bucket == 65) { return "NaN/inf"; }
+        if (bucket <= 16) {
+            return to_string(uint64_t(1) << (bucket-1)) + "-" + to_string((uint64_t(1) << bucket) - 1);
+        }
+        return "2^" + to_string(bucket-1) + "-2^" + to_string(bucket);
+    }
+
+    template <class F>
+    FloatErrorSummary summarizeFloatErrors(const F* expected, const F* actual, size_t n) {
+        FloatErrorSummary ret;
+        mutex m;
+        auto summarize = [&](size_t first, size_t last) {
+            FloatErrorSummary local;
+            for (auto i = first; i < last; ++i) {
+                const F e = expected[i];
+                const F a = actual[i];
+                if (!std::isfinite(e) || !std::isfinite(a)) {
+                    const bool same = (e == a) || (std::isnan(e) && std::isnan(a));
+                    ++local.histogram[same ? 0 : 65];
+                    continue;
+                }
+
+                const double absError = std::abs(double(e) - double(a));
+                if (absError > local.maxAbsError) {
+                    local.maxAbsError = absError;
+                    local.maxAbsErrorIndex = i;
+                }
+                const uint64_t ulps = ulpDistance(e, a);
+                if (ulps > local.maxUlpError) {
+                    local.maxUlpError = ulps;
+                    local.maxUlpErrorIndex = i;
+                }
+                ++local.histogram[ulps == 0 ? 0 : size_t(64 - __builtin_clzll(ulps))];
+            }
+
+            lock_guard<mutex> l(m);
+            ret.merge(local);
+        };
+
+        if (n < parallelRangeThreshold) {
+            summarize(0, n);
+        }
+        else {
+            _private::parallelForChunks(0, n, summarize);
+        }
+        return ret;
+    }
+
+    template <class F>
+    bool compareFloatArrays(const F* expected, size_t nExpected,
+                            const F* actual, size_t nActual,
+                            const FloatTolerance& tolerance)
+    {
+        const auto n = min(nExpected, nActual);
+        const TypedTolerance<F> tol(tolerance);
+        const auto mismatches = _private::findRangeMismatches(n, [&](size_t first, size_t last) {
+            unsigned failures = 0;
+            for (auto i = first; i < last; ++i) {
+                failures += unsigned(!isClose(expected[i], actual[i], tol));
+            }
+            return (failures == 0);
+        }, [&](size_t i) { return isClose(expected[i], actual[i], tol); });
+
+        if (mismatches.count == 0 && nExpected == nActual) {
+            return true;
+        }
+
+        ostringstream strm;
+        strm << setprecision(numeric_limits<F>::max_digits10);
+        if (nExpected != nActual) {
+            strm << "sizes differ, expected " << nExpected << ", actual was " << nActual;
+            if (mismatches.count > 0) { strm << "; "; }
+        }
+        if (mismatches.count > 0) {
+            strm << _private::describeRangeMismatches(mismatches, n, "differ", [&](size_t i) {
+                ostringstream s;
+                s << setprecision(numeric_limits<F>::max_digits10)
+                  << "expected (" << expected[i] << "), actual was (" << actual[i] << ")";
+                return s.str();
+            });
+
+            if (n > 1) {
+                const auto summary = summarizeFloatErrors(expected, actual, n);
+                strm << "; max abs error " << summary.maxAbsError << " at [" << summary.maxAbsErrorIndex << "]"
+                    << ", max ulp error " << summary.maxUlpError << " at [" << summary.maxUlpErrorIndex << "]"
+                    << "; ulp error histogram";
+                const char* separator = ": ";
+                for (size_t i = 0; i < summary.histogram.size(); ++i) {
+                    if (summary.histogram[i] > 0) {
+                        strm << separator << histogramBucketName(i) << " x" << summary.histogram[i];
+                        separator = ", ";
+                    }
+                }
+            }
+        }
+        _private::setFailureDetails(strm.str());
+        return false;
+    }
 }
 
 
@@ -1456,31 +5692,103 @@ void TestSuite::setTestCaseContext(test_case_context_t ctx) noexcept {
 
 namespace kss { namespace test { namespace _private {
 
+    bool scalesAs(Complexity complexity, const vector<size_t>& sizes,
+                  const function<function<void()>(size_t)>& prepare)
+    {
+        if (sizes.size() < 3) {
+            throw invalid_argument("scalesAs: at least 3 sizes are required");
+        }
+
+        // Each round times every size, so that any drift in the speed of the machine
+        // affects all of them, and the fastest time of each size is kept.
+        vector<double> times(sizes.size(), numeric_limits<double>::infinity());
+        {
+            CpuPin pin;
+            for (unsigned round = 0; round < scalingRunsPerSize; ++round) {
+                for (size_t i = 0; i < sizes.size(); ++i) {
+                    const auto fn = prepare(sizes[i]);
+                    prepareCachesForTiming();
+                    times[i] = min(times[i], timeOfExecution(fn).count());
+                }
+            }
+        }
+
+        vector<ComplexityFit> fits;
+        for (auto c : { Complexity::Constant, Complexity::LogN, Complexity::N,
+                        Complexity::NLogN, Complexity::NSquared, Complexity::NCubed })
+        {
+            fits.push_back(fitComplexity(c, sizes, times));
+        }
+        const auto& best = *min_element(fits.begin(), fits.end(), [](const auto& a, const auto& b) {
+            return a.relativeRms < b.relativeRms;
+        });
+        const auto& expected = fits[size_t(complexity)];
+
+        if (currentTest) {
+            lock_guard<mutex> l(failuresLock);
+            auto& m = currentTest->measurements;
+            m["bestFit"] = nameOfComplexity(best.complexity);
+            for (const auto& fit : fits) {
+                ostringstream coefficient;
+                coefficient << setprecision(6) << fit.coefficient;
+                m[string("coefficient") + nameOfComplexity(fit.complexity)] = coefficient.str();
+                m[string("rms") + nameOfComplexity(fit.complexity)] = to_string(fit.relativeRms);
+            }
+        }
+
+        if (best.complexity > complexity && expected.relativeRms > best.relativeRms * scalingFitTolerance) {
+            ostringstream strm;
+            strm << setprecision(3)
+                << "best fit was " << nameOfComplexity(best.complexity) << " (rms " << best.relativeRms
+                << "), " << nameOfComplexity(complexity) << " had rms " << expected.relativeRms
+                << "; times:";
+            for (size_t i = 0; i < sizes.size(); ++i) {
+                strm << " " << sizes[i] << "=" << describeTime(times[i]);
+            }
+            setFailureDetails(strm.str());
+            return false;
+        }
+        return true;
+    }
+
     void success(void) noexcept {
         assert(currentTest != nullptr);
-        ++currentTest->assertions;
-        if (isVerboseMode) {
+        currentTest->assertions.increment();
+        if (!mostRecentDetails.empty()) {
+            mostRecentDetails.clear();
+        }
+        if (isVerboseMode && !isRepeating()) {
             cout << ".";
         }
     }
 
     void failure(const char* expr, const char* filename, unsigned int line) noexcept {
         assert(currentTest != nullptr);
-        ++currentTest->assertions;
+        currentTest->assertions.increment();
         auto f = make_pair(string(path(filename).filename()) + ": " + to_string(line) + ", " + expr,
-                           currentTest->mostRecentDetails);
+                           move(mostRecentDetails));
         if (f.first.size() > maxFailureReportLineLength) {
             f.first.resize(maxFailureReportLineLength);
             f.first.append("...");
         }
-        currentTest->failures.push_back(move(f));
-        currentTest->mostRecentDetails = "";
-        if (isVerboseMode) {
+        if (currentTest->suiteWrapper) {
+            reporterPipeline().post(Reporter::Event::Kind::AssertionFailed,
+                                  currentTest->suiteWrapper->suite->name(), currentTest->name, f.first);
+        }
+        {
+            lock_guard<mutex> l(failuresLock);
+            currentTest->failures.push_back(move(f));
+        }
+        mostRecentDetails.clear();
+        if (isVerboseMode && !isRepeating()) {
             cout << "F";
         }
     }
 
     bool completesWithinSec(const duration<double>& d, const function<void()>& fn) {
+        CpuPin pin;
+        prepareCachesForTiming();
+
         // The condition variable is used to ensure that fn does not cause us to stop
         // more than 4x the requested duration. If it does, we terminate the process.
         condition_variable cv;
@@ -1513,7 +5821,151 @@ namespace kss { namespace test { namespace _private {
 
     void setFailureDetails(const string& d) {
         assert(currentTest != nullptr);
-        currentTest->mostRecentDetails = d;
+        mostRecentDetails = d;
+    }
+
+    void* currentTestCaseContext() noexcept {
+        return currentTest;
+    }
+
+    void* exchangeTestCaseContext(void* ctx) noexcept {
+        auto* previous = currentTest;
+        currentTest = static_cast<TestCaseWrapper*>(ctx);
+        currentSuite = (currentTest ? currentTest->suiteWrapper : nullptr);
+        return previous;
+    }
+
+    void parallelForChunks(size_t first, size_t last, const function<void(size_t, size_t)>& fn) {
+        if (first >= last) {
+            return;
+        }
+
+        // Split the range into (at most) one chunk per worker plus one for this thread,
+        // which runs the first chunk itself.
+        auto& ex = executor();
+        const size_t n = last - first;
+        const size_t numberOfChunks = min<size_t>(n, ex.concurrency() + 1);
+        const size_t chunkSize = (n + numberOfChunks - 1) / numberOfChunks;
+
+        vector<Executor::task_t> tasks;
+        tasks.reserve(numberOfChunks);
+        for (size_t chunkFirst = first + chunkSize; chunkFirst < last; chunkFirst += chunkSize) {
+            const size_t chunkLast = min(last, chunkFirst + chunkSize);
+            tasks.push_back(ex.submit([&fn, chunkFirst, chunkLast] { fn(chunkFirst, chunkLast); }));
+        }
+
+        exception_ptr firstException;
+        try {
+            fn(first, min(last, first + chunkSize));
+        }
+        catch (...) {
+            firstException = current_exception();
+        }
+
+        try {
+            ex.wait(tasks);
+        }
+        catch (...) {
+            if (!firstException) { firstException = current_exception(); }
+        }
+
+        if (firstException) {
+            rethrow_exception(firstException);
+        }
+    }
+
+    size_t findFirstDivergence(size_t count, const function<bool(size_t)>& matches) {
+        atomic<size_t> firstDivergence { count };
+        parallelForChunks(0, count, [&](size_t first, size_t last) {
+            for (auto i = first; i < last && i < firstDivergence.load(memory_order_relaxed); ++i) {
+                if (!matches(i)) {
+                    auto previous = firstDivergence.load();
+                    while (i < previous && !firstDivergence.compare_exchange_weak(previous, i)) {}
+                    return;
+                }
+            }
+        });
+        return firstDivergence;
+    }
+
+    RangeMismatches findRangeMismatches(size_t n,
+                                        const function<bool(size_t, size_t)>& chunkPasses,
+                                        const function<bool(size_t)>& elementPasses)
+    {
+        RangeMismatches ret;
+        mutex m;
+
+        // Check [first, last) a chunk at a time, merging any failures into ret.
+        auto checkChunks = [&](size_t first, size_t last) {
+            RangeMismatches local;
+            for (auto chunkFirst = first; chunkFirst < last; chunkFirst += rangeChunkSize) {
+                const auto chunkLast = min(last, chunkFirst + rangeChunkSize);
+                if (!chunkPasses(chunkFirst, chunkLast)) {
+                    for (auto i = chunkFirst; i < chunkLast; ++i) {
+                        if (!elementPasses(i)) {
+                            if (local.count++ < maxReportedRangeMismatches) {
+                                local.firstIndices.push_back(i);
+                            }
+                        }
+                    }
+                }
+            }
+
+            if (local.count > 0) {
+                lock_guard<mutex> l(m);
+                ret.count += local.count;
+                auto& indices = ret.firstIndices;
+                indices.insert(indices.end(), local.firstIndices.begin(), local.firstIndices.end());
+                sort(indices.begin(), indices.end());
+                if (indices.size() > maxReportedRangeMismatches) {
+                    indices.resize(maxReportedRangeMismatches);
+                }
+            }
+        };
+
+        if (n < parallelRangeThreshold) {
+            checkChunks(0, n);
+        }
+        else {
+            // Split on chunk boundaries so that no chunk is shared between threads.
+            const size_t numberOfChunks = (n + rangeChunkSize - 1) / rangeChunkSize;
+            parallelForChunks(0, numberOfChunks, [&](size_t firstChunk, size_t lastChunk) {
+                checkChunks(firstChunk * rangeChunkSize, min(n, lastChunk * rangeChunkSize));
+            });
+        }
+        return ret;
+    }
+
+    string describeRangeMismatches(const RangeMismatches& mismatches,
+                                   size_t n,
+                                   const string& what,
+                                   const function<string(size_t)>& describeElement)
+    {
+        ostringstream strm;
+        strm << mismatches.count << " of " << n << " elements " << what;
+        const char* separator = ": ";
+        for (auto i : mismatches.firstIndices) {
+            strm << separator << '[' << i << "] " << describeElement(i);
+            separator = ", ";
+        }
+        if (mismatches.count > mismatches.firstIndices.size()) {
+            strm << ", ...";
+        }
+        return strm.str();
+    }
+
+    bool floatArraysAreClose(const float* expected, size_t nExpected,
+                             const float* actual, size_t nActual,
+                             const FloatTolerance& tolerance)
+    {
+        return compareFloatArrays(expected, nExpected, actual, nActual, tolerance);
+    }
+
+    bool floatArraysAreClose(const double* expected, size_t nExpected,
+                             const double* actual, size_t nActual,
+                             const FloatTolerance& tolerance)
+    {
+        return compareFloatArrays(expected, nExpected, actual, nActual, tolerance);
     }
 
     string demangleName(const char* mangledName) {
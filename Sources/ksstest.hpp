@@ -12,21 +12,35 @@
 
 #include <chrono>
 #include <cmath>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <exception>
 #include <functional>
 #include <initializer_list>
 #include <iostream>
+#include <iterator>
 #include <limits>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <sstream>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <system_error>
+#include <thread>
+#include <type_traits>
 #include <typeinfo>
 #include <utility>
+#include <vector>
 
 namespace kss::test {
 
+    struct FloatTolerance;
+    enum class Complexity;
+    class FixtureFile;
+
     namespace _private {
         void success(void) noexcept;
         void failure(const char* expr, const char* filename, unsigned int line) noexcept;
@@ -41,6 +55,111 @@ namespace kss::test {
             return demangleName(typeid(t).name());
         }
 
+        // Obtain the test case context of the current thread (nullptr if there is none)
+        // and replace it, returning the previous value.
+        void* currentTestCaseContext() noexcept;
+        void* exchangeTestCaseContext(void* ctx) noexcept;
+
+        // Installs a test case context for the lifetime of the guard.
+        class TestCaseContextGuard {
+        public:
+            explicit TestCaseContextGuard(void* ctx) noexcept : _previous(exchangeTestCaseContext(ctx)) {}
+            ~TestCaseContextGuard() noexcept { exchangeTestCaseContext(_previous); }
+            TestCaseContextGuard(const TestCaseContextGuard&) = delete;
+            TestCaseContextGuard& operator=(const TestCaseContextGuard&) = delete;
+
+        private:
+            void* _previous;
+        };
+
+        void parallelForChunks(std::size_t first, std::size_t last,
+                               const std::function<void(std::size_t, std::size_t)>& fn);
+
+        // Describe a value for a failure report, if it can be written to a stream.
+        template <class T, class = void>
+        struct is_streamable : std::false_type {};
+
+        template <class T>
+        struct is_streamable<T, std::void_t<decltype(std::declval<std::ostream&>() << std::declval<const T&>())>>
+        : std::true_type {};
+
+        template <class T>
+        std::string describe(const T& t) {
+            if constexpr (is_streamable<T>::value) {
+                std::ostringstream strm;
+                strm << t;
+                return strm.str();
+            }
+            else {
+                return "<" + demangle(t) + ">";
+            }
+        }
+
+        // Ranges that provide std::data are contiguous in memory.
+        template <class Range, class = void>
+        struct is_contiguous : std::false_type {};
+
+        template <class Range>
+        struct is_contiguous<Range, std::void_t<decltype(std::data(std::declval<const Range&>()))>>
+        : std::true_type {};
+
+        template <class Range>
+        using range_iterator_t = decltype(std::begin(std::declval<const Range&>()));
+
+        template <class Range>
+        using range_value_t = typename std::iterator_traits<range_iterator_t<Range>>::value_type;
+
+        template <class Range>
+        constexpr bool is_random_access_v = std::is_base_of_v<std::random_access_iterator_tag,
+            typename std::iterator_traits<range_iterator_t<Range>>::iterator_category>;
+
+        // The result of checking a range: the number of elements that failed and the
+        // (lowest) indices of the first few of them.
+        constexpr std::size_t maxReportedRangeMismatches = 10;
+
+        struct RangeMismatches {
+            std::size_t                 count = 0;
+            std::vector<std::size_t>    firstIndices;
+        };
+
+        // Check the indices [0, n) in chunks. chunkPasses(first, last) should check an
+        // entire chunk as cheaply as possible. Only when it fails is elementPasses(i)
+        // used to identify the individual failures. Large ranges are split across the
+        // executor.
+        RangeMismatches findRangeMismatches(std::size_t n,
+                                            const std::function<bool(std::size_t, std::size_t)>& chunkPasses,
+                                            const std::function<bool(std::size_t)>& elementPasses);
+
+        // Returns the lowest index in [0, count) for which matches returns false, or count
+        // if there is none. The indices are split across the executor, and each thread stops
+        // once it passes a divergence that has already been found.
+        std::size_t findFirstDivergence(std::size_t count, const std::function<bool(std::size_t)>& matches);
+
+        std::string describeRangeMismatches(const RangeMismatches& mismatches,
+                                            std::size_t n,
+                                            const std::string& what,
+                                            const std::function<std::string(std::size_t)>& describeElement);
+
+        // Compare floating point arrays, setting the failure details if they are not close.
+        bool floatArraysAreClose(const float* expected, std::size_t nExpected,
+                                 const float* actual, std::size_t nActual,
+                                 const FloatTolerance& tolerance);
+        bool floatArraysAreClose(const double* expected, std::size_t nExpected,
+                                 const double* actual, std::size_t nActual,
+                                 const FloatTolerance& tolerance);
+
+        // The cache of cachedFixture. The lock serializes the building of each fixture
+        // within the process, and findCachedFixture returns nullptr if it is not cached.
+        std::unique_lock<std::mutex> lockCachedFixture(const std::string& key);
+        std::shared_ptr<const FixtureFile> findCachedFixture(const std::string& key, std::string_view inputsHash);
+        void storeCachedFixture(const std::string& key, std::string_view inputsHash,
+                                const std::function<void(std::ostream&)>& serialize);
+
+        // Time the lambdas returned by prepare(size) for each size, and fit the times to
+        // the complexity classes. prepare is called, untimed, for every timed call.
+        bool scalesAs(Complexity complexity,
+                      const std::vector<std::size_t>& sizes,
+                      const std::function<std::function<void()>(std::size_t)>& prepare);
       }
 
     // MARK: Running
@@ -88,6 +207,22 @@ namespace kss::test {
      */
     [[nodiscard]] bool isVerbose() noexcept;
 
+    /*!
+     Returns the seed that the current test case should use for any random numbers it
+     needs. It is given by --seed (or chosen at random if that is not specified) and is
+     one larger for each repetition when --repeat or --until-failure is used. The reports
+     include the seed of the first failing repetition of each failed test case, so that
+     the failure can be reproduced by rerunning with that seed.
+
+     This may only be called from within a test case (or a thread that has its context).
+
+     example:
+     @code
+     std::mt19937_64 rng(seed());
+     @endcode
+     */
+    [[nodiscard]] std::uint64_t seed() noexcept;
+
 
     // MARK: Assertions
 
@@ -198,6 +333,46 @@ namespace kss::test {
         return isCloseTo<T>(a, std::numeric_limits<T>::epsilon(), fn);
     }
 
+    /*!
+     Describes how close two floating point values must be in order to be considered
+     equal. The tolerance of isCloseTo(a, tolerance, fn) is absolute, which is rarely
+     what you want for values of large (or very small) magnitude. Two values are close
+     under this tolerance if any of the following are true:
+
+     - they differ by no more than absolute,
+     - they differ by no more than relative * max(|a|, |b|), or
+     - they are no more than ulps units in the last place apart (i.e. there are no more
+       than ulps - 1 representable values between them).
+
+     Two NaNs are considered close to each other, but not to any number. An infinity is
+     only close to the same infinity.
+
+     The members are in the order absolute, relative, ulps, so for example
+     FloatTolerance{ 1e-9, 1e-6 } allows an absolute error of 1e-9 (useful near zero),
+     a relative error of 1e-6, or 4 ulps.
+     */
+    struct FloatTolerance {
+        double          absolute = 0.0;
+        double          relative = 0.0;
+        std::uint64_t   ulps = 4;
+    };
+
+    /*!
+     Returns true if the lambda returns a float or double that is close to a, as
+     described by tolerance.
+     example:
+     @code
+     KSS_ASSERT(isCloseTo(1e20, FloatTolerance{ 0, 1e-9 }, []{ return 1e20 + 1e5; }));
+     @endcode
+     */
+    template <class T>
+    [[nodiscard]] bool isCloseTo(const T& a, const FloatTolerance& tolerance, const std::function<T()>& fn) {
+        static_assert(std::is_same_v<T, float> || std::is_same_v<T, double>,
+                      "FloatTolerance may only be used with float or double");
+        const T res = fn();
+        return _private::floatArraysAreClose(&a, 1, &res, 1, tolerance);
+    }
+
     /*!
      Returns true if the lambda returns a value that is not within tolerance of a.
      example:
@@ -387,6 +562,155 @@ namespace kss::test {
         return _private::completesWithinSec(duration_cast<duration<double>>(d), fn);
     }
 
+    /*!
+     Returns true if fnA is faster than fnB by at least a factor of minSpeedup, with
+     statistical significance. Each is called numberOfRuns times (after one call to warm
+     up), alternating between them so that any drift in the speed of the machine affects
+     both equally. The times of fnA, multiplied by minSpeedup, are then compared with those
+     of fnB using a one-sided Mann-Whitney U test, which passes if p < 0.01.
+
+     The failure details include the quartiles of both sets of times and the speedup of
+     their medians. Each call should take at least a few microseconds, so if the code being
+     compared is quicker than that, loop over it within the lambdas.
+
+     @throws std::invalid_argument if minSpeedup is not positive or numberOfRuns is less
+        than 2.
+
+     example:
+     @code
+     KSS_ASSERT(isFasterThan([]{ fastSort(data); }, []{ referenceSort(data); }, 1.5));
+     @endcode
+     */
+    [[nodiscard]] bool isFasterThan(const std::function<void()>& fnA,
+                                    const std::function<void()>& fnB,
+                                    double minSpeedup = 1.0,
+                                    unsigned numberOfRuns = 30);
+
+    /*!
+     The complexity classes that scalesAs fits the times of code to, in order from the
+     best to the worst.
+     */
+    enum class Complexity {
+        Constant,       // O(1)
+        LogN,           // O(log n)
+        N,              // O(n)
+        NLogN,          // O(n log n)
+        NSquared,       // O(n^2)
+        NCubed          // O(n^3)
+    };
+
+    /*!
+     Returns the sizes from first to last (inclusive) with each being factor times the
+     previous one. This is a convenient sweep of input sizes for scalesAs.
+
+     @throws std::invalid_argument if first is 0, last is less than first, or factor
+        is not greater than 1.
+     */
+    std::vector<std::size_t> geometricSizes(std::size_t first, std::size_t last, double factor = 2.0);
+
+    /*!
+     Returns true if the time taken by fn grows with the size of its input no worse than
+     the given complexity. For each size, makeInput(size) creates an input (untimed) and
+     fn(input) is timed, several times with a fresh input each time, keeping the fastest.
+     Those times are fitted to each complexity class by least squares, and the assertion
+     fails if the best fit is a worse class than the one given (unless the given class
+     fits nearly as well).
+
+     The coefficient and the relative root mean square residual of each fit are added to
+     the test case in the XML and JSON reports. The sizes should span at least a factor of
+     100 for the classes to be told apart, and the largest should take at least a
+     millisecond. This shares the --pin-cpu and --cold-cache settings of completesWithin.
+
+     The times are wall clock times, so anything else using the CPUs makes them noisy.
+     Classes that differ by a power of n (such as n and n^2) are told apart reliably, but
+     telling n from n log n needs a span of 1000 or more and a machine that is otherwise
+     idle, e.g. a suite that needs all the "cores" (see UsesResources) on an unloaded
+     machine. Memory bound code is also affected by the sizes of the caches.
+
+     @throws std::invalid_argument if fewer than 3 sizes are given.
+
+     example:
+     @code
+     KSS_ASSERT(scalesAs(Complexity::NLogN, geometricSizes(1000, 1000000),
+                         [](size_t n) { return randomVector(n); },
+                         [](vector<int>& v) { sort(v.begin(), v.end()); }));
+     @endcode
+     */
+    template <class MakeInput, class Fn>
+    [[nodiscard]] bool scalesAs(Complexity complexity,
+                                const std::vector<std::size_t>& sizes,
+                                MakeInput makeInput,
+                                Fn fn)
+    {
+        return _private::scalesAs(complexity, sizes, [&](std::size_t n) -> std::function<void()> {
+            using input_t = std::decay_t<decltype(makeInput(n))>;
+            auto input = std::make_shared<input_t>(makeInput(n));
+            return [&fn, input] { fn(*input); };
+        });
+    }
+
+    /*!
+     Prevents the compiler from optimizing away the calculation of value, or moving it
+     out of the code being timed, without adding any instructions of its own. Use this on
+     the results of benchmarked code that are otherwise unused.
+
+     example:
+     @code
+     KSS_ASSERT(completesWithin(2ms, []{ doNotOptimize(calculateChecksum(data)); }));
+     @endcode
+     */
+    template <class T>
+    inline void doNotOptimize(const T& value) noexcept {
+        __asm__ __volatile__("" : : "r,m"(value) : "memory");
+    }
+
+    /*!
+     Prevents the compiler from assuming anything about the contents of memory at this
+     point, forcing the writes before it to actually take place. Use this when benchmarked
+     code writes to memory that is never read.
+     */
+    inline void clobberMemory() noexcept {
+        __asm__ __volatile__("" : : : "memory");
+    }
+
+    /*!
+     Returns true if calling the lambda executes fewer than maxInstructions instructions
+     per call, averaged over numberOfCalls calls (after one call to warm up). Only the
+     user space instructions of the calling thread are counted, which makes this far less
+     noisy than timing and suitable for catching performance regressions.
+
+     The count comes from the CPU's performance counters on Linux. Where there are none
+     (as is common in containers and virtual machines, and on other systems) the
+     instructions cannot be counted, so this returns true and a warning is written to
+     cerr. Use instructionCountersAvailable() to skip the test case instead.
+
+     example:
+     @code
+     if (!instructionCountersAvailable()) { skip(); }
+     KSS_ASSERT(instructionsPerCallBelow(5000, []{ parseHeader(sampleHeader); }));
+     @endcode
+     */
+    [[nodiscard]] bool instructionsPerCallBelow(std::uint64_t maxInstructions,
+                                                const std::function<void()>& fn,
+                                                unsigned numberOfCalls = 10);
+
+    /*!
+     Returns true if the instructions of the calling thread can be counted, which is what
+     instructionsPerCallBelow needs.
+     */
+    [[nodiscard]] bool instructionCountersAvailable() noexcept;
+
+    // The following "death tests" run the lambda in a forked child process, so that it can
+    // safely do things that would end the test program. They do not touch the signal
+    // handlers of the test program and may be run concurrently. If the child has not died
+    // within the timeout it is killed and the assertion fails. (Note that SIGCHLD must not
+    // be set to SIG_IGN, otherwise the exit status of the child cannot be obtained.)
+
+    /*!
+     The timeout used by the death tests when none is given.
+     */
+    constexpr std::chrono::seconds defaultDeathTestTimeout { 30 };
+
     /*!
      Returns true if the lambda causes terminate to be called.
      example:
@@ -398,7 +722,397 @@ namespace kss::test {
      KSS_ASSERT(terminates([]{ cannot_throw() }));
      @endcode
      */
-    [[nodiscard]] bool terminates(const std::function<void()>& fn);
+    [[nodiscard]] bool terminates(const std::function<void()>& fn,
+                                  std::chrono::duration<double> timeout = defaultDeathTestTimeout);
+
+    /*!
+     Returns true if the lambda causes the process to exit with the given exit code (e.g.
+     by calling std::exit). Returning normally from the lambda does not count as exiting.
+
+     example:
+     @code
+     KSS_ASSERT(exitsWith(2, []{ parseCommandLine({ "--no-such-option" }); }));
+     @endcode
+     */
+    [[nodiscard]] bool exitsWith(int exitCode,
+                                 const std::function<void()>& fn,
+                                 std::chrono::duration<double> timeout = defaultDeathTestTimeout);
+
+    /*!
+     Returns true if the lambda causes the process to be killed by the given signal. The
+     child process does not write a core file.
+
+     example:
+     @code
+     KSS_ASSERT(killedBySignal(SIGABRT, []{ assert(false); }, 5s));
+     @endcode
+     */
+    [[nodiscard]] bool killedBySignal(int signalNumber,
+                                      const std::function<void()>& fn,
+                                      std::chrono::duration<double> timeout = defaultDeathTestTimeout);
+
+
+    // MARK: Range Assertions
+
+    // The following check every element of a range but record a single assertion, which
+    // makes them far cheaper than calling KSS_ASSERT for each element of a large range.
+    // Random access ranges are checked in chunks (allowing the compiler to vectorize the
+    // checks) and large ranges are split across the executor. When they fail, the failure
+    // details report the number of failing elements and the first few of them.
+
+    /*!
+     Macro asserting that every element of a range satisfies a predicate. The predicate
+     is passed as the remaining arguments so that lambdas with several captures do not
+     need to be wrapped in parentheses. Note that the predicate may be called from
+     several threads at once.
+
+     example:
+     @code
+     KSS_ASSERT_ALL(v, [](int i) { return i >= 0; });
+     @endcode
+     */
+#	define KSS_ASSERT_ALL(range, ...) ((void) (kss::test::allElementsSatisfy((range), __VA_ARGS__) ? kss::test::_private::success() : kss::test::_private::failure("KSS_ASSERT_ALL(" #range ", " #__VA_ARGS__ ")", __FILE__, __LINE__)))
+
+    /*!
+     Macro asserting that two ranges have the same size and equal elements. If either
+     argument contains a comma outside of parentheses (e.g. vector<int>{1, 2}) it needs
+     to be wrapped in parentheses.
+
+     example:
+     @code
+     KSS_ASSERT_EQUAL_RANGES(expected, actual);
+     @endcode
+     */
+#	define KSS_ASSERT_EQUAL_RANGES(a, b) ((void) (kss::test::rangesAreEqual((a), (b)) ? kss::test::_private::success() : kss::test::_private::failure("KSS_ASSERT_EQUAL_RANGES(" #a ", " #b ")", __FILE__, __LINE__)))
+
+    /*!
+     Returns true if pred returns true for every element of the range. This is what
+     KSS_ASSERT_ALL uses, and it may also be used within KSS_ASSERT.
+
+     example:
+     @code
+     KSS_ASSERT(allElementsSatisfy(v, [](int i) { return i >= 0; }));
+     @endcode
+     */
+    template <class Range, class Pred>
+    [[nodiscard]] bool allElementsSatisfy(const Range& r, Pred&& pred) {
+        const auto first = std::begin(r);
+        const auto n = static_cast<std::size_t>(std::distance(first, std::end(r)));
+
+        _private::RangeMismatches mismatches;
+        if constexpr (_private::is_random_access_v<Range>) {
+            mismatches = _private::findRangeMismatches(n, [&](std::size_t f, std::size_t l) {
+                unsigned failures = 0;
+                for (auto i = f; i < l; ++i) {
+                    failures += unsigned(!pred(first[i]));
+                }
+                return (failures == 0);
+            }, [&](std::size_t i) { return static_cast<bool>(pred(first[i])); });
+        }
+        else {
+            std::size_t i = 0;
+            for (auto it = first; it != std::end(r); ++it, ++i) {
+                if (!pred(*it)) {
+                    if (mismatches.count++ < _private::maxReportedRangeMismatches) { mismatches.firstIndices.push_back(i); }
+                }
+            }
+        }
+
+        if (mismatches.count > 0) {
+            _private::setFailureDetails(_private::describeRangeMismatches(mismatches, n, "failed the predicate", [&](std::size_t i) {
+                return "(" + _private::describe(*std::next(first, static_cast<std::ptrdiff_t>(i))) + ")";
+            }));
+        }
+        return (mismatches.count == 0);
+    }
+
+    /*!
+     Returns true if the two ranges have the same size and equal elements. This is what
+     KSS_ASSERT_EQUAL_RANGES uses, and it may also be used within KSS_ASSERT. If both
+     ranges are contiguous with the same element type, and the elements are equal exactly
+     when their bytes are equal (e.g. integers, but not floating point), they are compared
+     using memcmp.
+
+     example:
+     @code
+     KSS_ASSERT(rangesAreEqual(expected, actual));
+     @endcode
+     */
+    template <class RangeA, class RangeB>
+    [[nodiscard]] bool rangesAreEqual(const RangeA& a, const RangeB& b) {
+        using value_a = _private::range_value_t<RangeA>;
+        using value_b = _private::range_value_t<RangeB>;
+
+        const auto firstA = std::begin(a);
+        const auto firstB = std::begin(b);
+        const auto nA = static_cast<std::size_t>(std::distance(firstA, std::end(a)));
+        const auto nB = static_cast<std::size_t>(std::distance(firstB, std::end(b)));
+        const auto n = std::min(nA, nB);
+
+        _private::RangeMismatches mismatches;
+        if constexpr (_private::is_contiguous<RangeA>::value && _private::is_contiguous<RangeB>::value
+                      && std::is_same_v<value_a, value_b>
+                      && std::has_unique_object_representations_v<value_a>)
+        {
+            const auto* dataA = std::data(a);
+            const auto* dataB = std::data(b);
+            mismatches = _private::findRangeMismatches(n, [&](std::size_t f, std::size_t l) {
+                return std::memcmp(dataA + f, dataB + f, (l - f) * sizeof(value_a)) == 0;
+            }, [&](std::size_t i) { return std::memcmp(dataA + i, dataB + i, sizeof(value_a)) == 0; });
+        }
+        else if constexpr (_private::is_random_access_v<RangeA> && _private::is_random_access_v<RangeB>) {
+            mismatches = _private::findRangeMismatches(n, [&](std::size_t f, std::size_t l) {
+                unsigned failures = 0;
+                for (auto i = f; i < l; ++i) {
+                    failures += unsigned(!(firstA[i] == firstB[i]));
+                }
+                return (failures == 0);
+            }, [&](std::size_t i) { return static_cast<bool>(firstA[i] == firstB[i]); });
+        }
+        else {
+            auto itA = firstA;
+            auto itB = firstB;
+            for (std::size_t i = 0; i < n; ++i, ++itA, ++itB) {
+                if (!(*itA == *itB)) {
+                    if (mismatches.count++ < _private::maxReportedRangeMismatches) { mismatches.firstIndices.push_back(i); }
+                }
+            }
+        }
+
+        if (mismatches.count > 0 || nA != nB) {
+            std::string details;
+            if (nA != nB) {
+                details = "sizes differ, expected " + std::to_string(nA) + ", actual was " + std::to_string(nB);
+            }
+            if (mismatches.count > 0) {
+                if (!details.empty()) { details += "; "; }
+                details += _private::describeRangeMismatches(mismatches, n, "differ", [&](std::size_t i) {
+                    const auto offset = static_cast<std::ptrdiff_t>(i);
+                    return "expected (" + _private::describe(*std::next(firstA, offset))
+                        + "), actual was (" + _private::describe(*std::next(firstB, offset)) + ")";
+                });
+            }
+            _private::setFailureDetails(details);
+            return false;
+        }
+        return true;
+    }
+
+    /*!
+     Returns true if two contiguous ranges of float or double (e.g. vectors or arrays)
+     have the same size and every pair of elements is close according to the tolerance
+     (see FloatTolerance). The common case of everything matching is checked by a tight
+     loop that the compiler can vectorize. On failure, the details report the first few
+     elements that differ, the maximum absolute and ulp errors and where they occurred,
+     and a histogram of the ulp errors over the whole range.
+
+     example:
+     @code
+     KSS_ASSERT(rangesAreClose(expected, actual, FloatTolerance{ 0, 1e-6 }));
+     @endcode
+     */
+    template <class RangeA, class RangeB>
+    [[nodiscard]] bool rangesAreClose(const RangeA& expected,
+                                      const RangeB& actual,
+                                      const FloatTolerance& tolerance = FloatTolerance())
+    {
+        using value_t = _private::range_value_t<RangeA>;
+        static_assert(_private::is_contiguous<RangeA>::value && _private::is_contiguous<RangeB>::value,
+                      "rangesAreClose requires contiguous ranges");
+        static_assert(std::is_same_v<value_t, _private::range_value_t<RangeB>>,
+                      "rangesAreClose requires ranges of the same type");
+        static_assert(std::is_same_v<value_t, float> || std::is_same_v<value_t, double>,
+                      "rangesAreClose requires ranges of float or double");
+        return _private::floatArraysAreClose(std::data(expected), std::size(expected),
+                                             std::data(actual), std::size(actual),
+                                             tolerance);
+    }
+
+    /*!
+     Returns true if optimized(input) == reference(input) for count inputs, where the i'th
+     input is generator(i). The inputs are split across the executor, so reference,
+     optimized and generator may be called from several threads at once, and the checking
+     stops early once a divergence is found. On failure, the details report the first
+     input that diverged along with both outputs.
+
+     The generator must return the same input for the same index, since a divergent input
+     is generated again to describe it. For random inputs, seed a generator with the index
+     (plus seed() if the test should vary from run to run).
+
+     example:
+     @code
+     KSS_ASSERT(matchesReference([](const string& s) { return referenceHash(s); },
+                                 [](const string& s) { return simdHash(s); },
+                                 [](size_t i) { return randomString(i); },
+                                 100000));
+     @endcode
+     */
+    template <class Reference, class Optimized, class Generator>
+    [[nodiscard]] bool matchesReference(Reference&& reference,
+                                        Optimized&& optimized,
+                                        Generator&& generator,
+                                        std::size_t count)
+    {
+        const auto i = _private::findFirstDivergence(count, [&](std::size_t index) {
+            const auto input = generator(index);
+            return static_cast<bool>(optimized(input) == reference(input));
+        });
+        if (i < count) {
+            const auto input = generator(i);
+            _private::setFailureDetails("diverged at input " + std::to_string(i)
+                                        + " (" + _private::describe(input)
+                                        + "), reference was (" + _private::describe(reference(input))
+                                        + "), optimized was (" + _private::describe(optimized(input)) + ")");
+            return false;
+        }
+        return true;
+    }
+
+
+    // MARK: Golden Files
+
+    /*!
+     Returns true if the contents of actual are identical to the contents of the golden
+     (reference) file. The golden file is memory mapped rather than read, and the two are
+     compared in large blocks, so even very large outputs can be compared cheaply. On
+     failure the details give the offset of the first difference along with the bytes
+     around it from both, shown as text if they look like text or as hex otherwise.
+
+     If the test program is run with --update-golden, the golden file is instead replaced
+     (atomically, so that a partially written file is never seen) by actual, creating any
+     missing directories, and this returns true.
+
+     example:
+     @code
+     KSS_ASSERT(matchesGoldenFile("Tests/golden/report.txt", generateReport()));
+     @endcode
+     */
+    [[nodiscard]] bool matchesGoldenFile(const std::string& goldenFilename, std::string_view actual);
+
+    /*!
+     As above, but the actual contents are read from a stream. The stream is read a block
+     at a time, hence the actual contents never need to be entirely in memory.
+
+     example:
+     @code
+     std::ifstream strm(outputFilename, std::ios::binary);
+     KSS_ASSERT(matchesGoldenFile("Tests/golden/output.bin", strm));
+     @endcode
+     */
+    [[nodiscard]] bool matchesGoldenFile(const std::string& goldenFilename, std::istream& actual);
+
+
+    // MARK: Fixture Files
+
+    /*!
+     A read-only, memory mapped view of a file, obtained from fixtureFile(). The file is
+     unmapped when the last shared_ptr to it is released.
+     */
+    class FixtureFile {
+    public:
+        ~FixtureFile() noexcept;
+
+        FixtureFile(const FixtureFile&) = delete;
+        FixtureFile& operator=(const FixtureFile&) = delete;
+
+        /*!
+         Accessors. The path is the canonical path of the file.
+         */
+        [[nodiscard]] const std::string& path() const noexcept;
+        [[nodiscard]] const char* data() const noexcept;
+        [[nodiscard]] std::size_t size() const noexcept;
+        [[nodiscard]] std::string_view view() const noexcept { return std::string_view(data(), size()); }
+
+    private:
+        friend std::shared_ptr<const FixtureFile> fixtureFile(const std::string& path, bool prefetch);
+
+        struct Impl;
+        std::unique_ptr<Impl> _impl;
+
+        explicit FixtureFile(std::unique_ptr<Impl> impl) noexcept;
+    };
+
+    /*!
+     Returns a read-only view of a (typically large) file that test data is read from.
+     The file is memory mapped, rather than read, and while any test suite holds on to
+     the view, every other request for the same file shares it. This saves both memory
+     and I/O when several suites, perhaps running in parallel, use the same data. Hold
+     on to the view only while it is needed (e.g. from BeforeAll to AfterAll) so that it
+     can be unmapped once the last suite using it has finished.
+
+     If prefetch is true the kernel is asked to start reading the whole file in now
+     (madvise with MADV_WILLNEED) rather than a page at a time as it is accessed.
+
+     @throws std::system_error if the file cannot be opened or mapped.
+
+     example:
+     @code
+     class LookupTestSuite : public TestSuite, public HasBeforeAll, public HasAfterAll {
+     public:
+         ...
+         void beforeAll() override { dataset = fixtureFile("Tests/data/words.txt", true); }
+         void afterAll() override { dataset.reset(); }
+         std::shared_ptr<const FixtureFile> dataset;
+     };
+     @endcode
+     */
+    [[nodiscard]] std::shared_ptr<const FixtureFile> fixtureFile(const std::string& path, bool prefetch = false);
+
+    /*!
+     Returns a hash of the contents of the given files, as a string of hex digits. Use
+     this for the inputsHash of cachedFixture when a fixture is built from files.
+
+     @throws std::system_error if any of the files cannot be read.
+     */
+    [[nodiscard]] std::string hashOfFiles(const std::vector<std::string>& filenames);
+
+    /*!
+     Returns a fixture that is expensive to build (e.g. an index or a trained table),
+     building it only if it has not already been built from the same inputs. The inputs
+     are identified by inputsHash, which should change whenever anything that the
+     fixture is built from changes (see hashOfFiles).
+
+     When the fixture is built, serialize(fixture, strm) writes it to a file in the cache
+     directory (see --fixture-cache) named by the key and the hash, replacing any built
+     from other inputs. The characters of the key that cannot be used in a filename are
+     escaped (as "%XX"), so different keys always have different files. Later calls with
+     the same key and hash, in this run or later ones, instead call deserialize(file)
+     where file is a FixtureFile (a memory mapping of what was written, which may be kept
+     to avoid copying it). If deserialize throws an exception the fixture is rebuilt.
+
+     The file is written atomically, so concurrent test runs never see a partial file,
+     and within a run the fixture is only built by one suite at a time.
+
+     @throws std::system_error if the cache file cannot be written.
+
+     example:
+     @code
+     void beforeAll() override {
+         index = cachedFixture<Index>("word index", hashOfFiles({ "Tests/data/words.txt" }),
+             []{ return Index::build("Tests/data/words.txt"); },
+             [](const Index& idx, std::ostream& strm) { idx.save(strm); },
+             [](const std::shared_ptr<const FixtureFile>& file) { return Index::load(file->view()); });
+     }
+     @endcode
+     */
+    template <class T, class Build, class Serialize, class Deserialize>
+    [[nodiscard]] T cachedFixture(const std::string& key, std::string_view inputsHash,
+                                  Build&& build, Serialize&& serialize, Deserialize&& deserialize)
+    {
+        const auto lock = _private::lockCachedFixture(key);
+        if (const auto file = _private::findCachedFixture(key, inputsHash)) {
+            try {
+                return deserialize(file);
+            }
+            catch (const std::exception&) {
+                // Rebuild a fixture whose cache file cannot be read.
+            }
+        }
+
+        T fixture = build();
+        _private::storeCachedFixture(key, inputsHash, [&](std::ostream& strm) { serialize(fixture, strm); });
+        return fixture;
+    }
 
 
     // MARK: TestSuite
@@ -478,6 +1192,10 @@ namespace kss::test {
          test case. (You can use a single thread across multiple test cases, but you
          must be certain to set the correct test case in each one before KSS_ASSERT
          is called.)
+
+         Most of the time you will find it easier to use kss::test::Thread, parallelFor
+         or withTestCaseContext (see below), which take care of this for you. Setting the
+         context also makes TestSuite::get() valid in the thread.
          */
         void setTestCaseContext(test_case_context_t ctx) noexcept;
 
@@ -540,12 +1258,449 @@ namespace kss::test {
      that do not use this interface. But any that inherit from this interface will
      not run in parallel with each other.
 
+     If the reason for this is that the suites use something that cannot be shared
+     (e.g. a fixed port number) consider UsesResources instead, which only keeps apart
+     the suites that use the same thing.
+
      (There are no methods in this interface. Simply having your class inherit from
      it will be enough.)
      */
     class MustNotBeParallel {
     };
 
+    /*!
+     Extend your TestSuite with this interface if its test cases may be run concurrently
+     with themselves. When the test cases are repeated (--repeat or --until-failure) the
+     repetitions of such suites are then spread across the executor, which both speeds
+     things up and makes intermittent concurrency failures more likely to show up.
+
+     (There are no methods in this interface. Simply having your class inherit from
+     it will be enough.)
+     */
+    class MayRepeatInParallel {
+    };
+
+    /*!
+     Extend your TestSuite with this interface to declare the resources that it needs
+     while it runs. Test suites are run in parallel only so long as, for every resource,
+     the total amount needed by the running suites is within its capacity.
+
+     Resources are named by strings of your choosing. Unless it has been given a capacity
+     by setResourceCapacity(), a resource has a capacity of 1, hence needing it means
+     needing it exclusively. The following resources are predefined:
+
+     - "cores": the number of threads the suite keeps busy. Suites that do not say
+       otherwise need 1. The capacity is the number of threads in the executor plus
+       the main thread.
+     - "memoryMB": the megabytes of memory the suite may use. The capacity is the
+       physical memory of the machine.
+
+     A suite that needs more of a resource than its capacity is treated as needing all
+     of it.
+
+     Waiting suites are started in order (by name, unless --failed-first says otherwise)
+     as soon as their needs fit. Nothing is held back for a suite that is waiting, so one
+     that needs several units of a busy resource (such as all of the cores) may be
+     overtaken by those after it, and in the worst case only start once they have all
+     finished.
+
+     example:
+     @code
+     class ServerTestSuite : public TestSuite, public UsesResources {
+     public:
+         ServerTestSuite(const std::string& name, test_case_list_t fns) : TestSuite(name, fns) {}
+
+         resources_t resources() const override {
+             return { { "port 8080", 1 }, { "cores", 4 }, { "memoryMB", 2048 } };
+         }
+     };
+     @endcode
+     */
+    class UsesResources {
+    public:
+        using resources_t = std::map<std::string, unsigned>;
+        virtual resources_t resources() const = 0;
+    };
+
+    /*!
+     Extend your TestSuite with this interface if it depends on other test suites (e.g.
+     because they build something that it uses). It will not be started until all the
+     suites it depends on have finished, and if any of them failed then all its tests
+     are skipped rather than run. Suites that do not depend on one another are still
+     run in parallel.
+
+     If the suite passes the --filter then the suites it depends on are run even if
+     they do not. Depending on a suite that does not exist, or a cycle of dependencies,
+     will cause run() to throw an std::invalid_argument exception.
+
+     example:
+     @code
+     class UsesDatabaseTestSuite : public TestSuite, public HasDependencies {
+     public:
+         UsesDatabaseTestSuite(const std::string& name, test_case_list_t fns) : TestSuite(name, fns) {}
+
+         std::vector<std::string> dependencies() const override {
+             return { "build database" };
+         }
+     };
+     @endcode
+     */
+    class HasDependencies {
+    public:
+        virtual std::vector<std::string> dependencies() const = 0;
+    };
+
+    /*!
+     Set the capacity of a resource used by UsesResources, allowing more than one suite
+     to use it at a time. (It can also be used to change the capacity of the predefined
+     resources.) This must be called before run().
+     */
+    void setResourceCapacity(const std::string& resourceName, unsigned capacity);
+
+
+    // MARK: Data Driven Test Suites
+
+    /*!
+     A row of the data file of a DataDrivenTestSuite. For a CSV file the columns are named
+     by its first line, and for a JSON lines file they are the members of the object on
+     each line. All values are given as strings.
+     */
+    class DataRow {
+    public:
+        DataRow(std::size_t number, std::string_view text, std::map<std::string, std::string> values)
+        : _number(number), _text(text), _values(std::move(values))
+        {}
+
+        /*!
+         Accessors. The number of the row is the line of the file that it starts on
+         (counting from 1, and including the header and any blank lines), so that it can be
+         found in an editor. The text is the row as it appears in the file.
+         */
+        [[nodiscard]] std::size_t number() const noexcept { return _number; }
+        [[nodiscard]] std::string_view text() const noexcept { return _text; }
+        [[nodiscard]] const std::map<std::string, std::string>& values() const noexcept { return _values; }
+
+        /*!
+         Returns true if the row has a value for the given column.
+         */
+        [[nodiscard]] bool has(const std::string& column) const { return _values.count(column) > 0; }
+
+        /*!
+         Returns the value of the given column.
+         @throws std::out_of_range if the row has no such column.
+         */
+        [[nodiscard]] const std::string& at(const std::string& column) const {
+            const auto it = _values.find(column);
+            if (it == _values.end()) {
+                throw std::out_of_range("Row " + std::to_string(_number) + " has no column '" + column + "'");
+            }
+            return it->second;
+        }
+
+    private:
+        std::size_t                         _number;
+        std::string_view                    _text;
+        std::map<std::string, std::string>  _values;
+    };
+
+    /*!
+     A test suite whose test cases come from the rows of a data file, either CSV (with a
+     header line naming the columns) or JSON lines (one flat object per line), as given by
+     the file's extension: ".csv", or ".jsonl" or ".ndjson". Each test case calls fn for
+     rowsPerCase rows, and is named by the value of keyColumn in its first row (or as "row N",
+     where N is the line of the file, if keyColumn is empty or missing), so that failures
+     can be traced back to the data that caused them. A test case of several rows is named
+     by its first and last rows, as in "first to last".
+
+     The file is not read until the suite is run, at which point it is memory mapped and
+     split into rows. Only the key of each row is read to name its test case, and the rest
+     of the row is parsed when the test case runs. Unless --no-parallel is given (or
+     repeating), the test cases are spread across the executor, so fn may be called from
+     several threads at once. If the file cannot be read the suite has a single test case,
+     named by the file, reporting the error.
+
+     As with TestSuite, a static instance must be declared to register the suite, and the
+     TestSuite Modifiers may be added by subclassing.
+
+     example:
+     @code
+     static DataDrivenTestSuite ts("conformance vectors", "vectors.csv", "id", [](const DataRow& row) {
+         KSS_ASSERT(decode(row.at("input")) == row.at("expected"));
+     });
+     @endcode
+     */
+    class DataDrivenTestSuite : public TestSuite {
+    public:
+        using row_fn = std::function<void(const DataRow&)>;
+
+        DataDrivenTestSuite(const std::string& testSuiteName,
+                            const std::string& filename,
+                            const std::string& keyColumn,
+                            row_fn fn,
+                            std::size_t rowsPerCase = 1);
+    };
+
+
+    // MARK: Threads
+
+    // The following take care of the testCaseContext()/setTestCaseContext() dance for
+    // you, allowing KSS_ASSERT (and TestSuite::get()) to be used from threads that are
+    // started by a test case.
+
+    /*!
+     Returns a callable that wraps fn so that, whichever thread it is invoked in, the
+     test case context of the thread calling withTestCaseContext is installed for the
+     duration of the call. (The previous context of the invoking thread is restored
+     afterwards.) This is the building block for handing work to your own executors.
+
+     example:
+     @code
+     auto fut = async(withTestCaseContext([]{ KSS_ASSERT(true); }));
+     fut.wait();
+     @endcode
+     */
+    template <class Fn>
+    [[nodiscard]] auto withTestCaseContext(Fn&& fn) {
+        return [ctx = _private::currentTestCaseContext(), fn = std::forward<Fn>(fn)](auto&&... args) mutable -> decltype(auto) {
+            _private::TestCaseContextGuard guard(ctx);
+            return fn(std::forward<decltype(args)>(args)...);
+        };
+    }
+
+    /*!
+     A thread that inherits the test case context of the thread that created it. Unlike
+     std::thread it will join (rather than terminate) if it is still running when it is
+     destroyed, and it cannot be detached, since KSS_ASSERT must not be called after
+     the test case has completed.
+
+     example:
+     @code
+     make_pair("my test", [] {
+         kss::test::Thread th { [] { KSS_ASSERT(true); } };
+     })
+     @endcode
+     */
+    class Thread {
+    public:
+        Thread() noexcept = default;
+
+        template <class Fn, class... Args>
+        explicit Thread(Fn&& fn, Args&&... args)
+        : _th(withTestCaseContext(std::forward<Fn>(fn)), std::forward<Args>(args)...)
+        {}
+
+        ~Thread() noexcept {
+            if (_th.joinable()) { _th.join(); }
+        }
+
+        Thread(Thread&&) noexcept = default;
+        Thread& operator=(Thread&& rhs) noexcept {
+            if (_th.joinable()) { _th.join(); }
+            _th = std::move(rhs._th);
+            return *this;
+        }
+
+        Thread(const Thread&) = delete;
+        Thread& operator=(const Thread&) = delete;
+
+        [[nodiscard]] bool joinable() const noexcept { return _th.joinable(); }
+        [[nodiscard]] std::thread::id get_id() const noexcept { return _th.get_id(); }
+        void join() { _th.join(); }
+
+    private:
+        std::thread _th;
+    };
+
+    /*!
+     Call fn(i) for each i in [first, last), splitting the range into contiguous chunks
+     that are run concurrently on the shared executor (see below), with the calling
+     thread running one of the chunks. Each chunk runs with the test case context of the caller,
+     so fn may use KSS_ASSERT. This returns when all the calls have completed. If any of
+     the calls throw an exception, the first one caught is rethrown in the calling thread.
+
+     example:
+     @code
+     parallelFor(0, v.size(), [&](size_t i) { KSS_ASSERT(v[i] > 0); });
+     @endcode
+     */
+    template <class Fn>
+    void parallelFor(std::size_t first, std::size_t last, Fn&& fn) {
+        _private::parallelForChunks(first, last, [&fn](std::size_t chunkFirst, std::size_t chunkLast) {
+            for (auto i = chunkFirst; i < chunkLast; ++i) {
+                fn(i);
+            }
+        });
+    }
+
+    /*!
+     Adapts an existing executor so that every task handed to it runs with the test
+     case context of the thread that submitted it. Executor needs to provide whichever
+     of execute(fn), submit(fn) or operator()(fn) you intend to call on the adapter.
+
+     example:
+     @code
+     MyThreadPool pool;
+     TestCaseContextExecutor ex(pool);
+     ex.execute([]{ KSS_ASSERT(true); });
+     @endcode
+     */
+    template <class Executor>
+    class TestCaseContextExecutor {
+    public:
+        explicit TestCaseContextExecutor(Executor& ex) noexcept : _ex(ex) {}
+
+        template <class Fn>
+        decltype(auto) execute(Fn&& fn) {
+            return _ex.execute(withTestCaseContext(std::forward<Fn>(fn)));
+        }
+
+        template <class Fn>
+        decltype(auto) submit(Fn&& fn) {
+            return _ex.submit(withTestCaseContext(std::forward<Fn>(fn)));
+        }
+
+        template <class Fn>
+        decltype(auto) operator()(Fn&& fn) {
+            return _ex(withTestCaseContext(std::forward<Fn>(fn)));
+        }
+
+    private:
+        Executor& _ex;
+    };
+
+
+    // MARK: Executor
+
+    /*!
+     A bounded pool of worker threads shared by the test runner (which uses it to run
+     the test suites in parallel) and by the test cases themselves. Tests that want
+     internal parallelism should use this rather than starting their own threads, so
+     that the machine does not become oversubscribed when suites run in parallel.
+
+     Tasks run with the test case context of the thread that submitted them, so they
+     may use KSS_ASSERT. A task must be waited for before its test case completes.
+
+     Obtain the executor by calling kss::test::executor().
+
+     example:
+     @code
+     auto& ex = executor();
+     auto task = ex.submit([]{ KSS_ASSERT(doSomeWork()); });
+     ex.wait(task);
+     @endcode
+     */
+    class Executor {
+    public:
+        class Task;
+        using task_t = std::shared_ptr<Task>;
+
+        ~Executor() noexcept;
+
+        Executor(const Executor&) = delete;
+        Executor& operator=(const Executor&) = delete;
+
+        /*!
+         Submit fn to be run by one of the worker threads. The test case context of the
+         calling thread is captured and will be installed in the worker.
+         */
+        [[nodiscard]] task_t submit(std::function<void()> fn);
+
+        /*!
+         Wait for the task(s) to complete. While waiting, the calling thread runs other
+         queued tasks rather than blocking, so it is safe to wait from within a task that
+         is itself running on the pool. If a task threw an exception it is rethrown here.
+         (When waiting on several tasks, all of them complete before the first exception
+         is rethrown.)
+         */
+        void wait(const task_t& task);
+        void wait(const std::vector<task_t>& tasks);
+
+        /*!
+         Returns the number of worker threads in the pool.
+         */
+        [[nodiscard]] unsigned concurrency() const noexcept;
+
+    private:
+        friend Executor& executor();
+        Executor();
+
+        struct Impl;
+        std::unique_ptr<Impl> _impl;
+
+    public:
+        // Never call this! It must be public to allow access in some of the
+        // implementation internals.
+        Impl* _implementation() noexcept { return _impl.get(); }
+    };
+
+    /*!
+     Returns the shared executor. The worker threads are started the first time this
+     is called.
+     */
+    [[nodiscard]] Executor& executor();
+
+
+    // MARK: Reporters
+
+    /*!
+     Implement this interface to receive the events of a test run as it happens, for
+     example to stream the results in a format of your own. Register the reporter with
+     addReporter before calling run().
+
+     The events are passed to the reporters by a dedicated reporter thread, so the
+     threads running the tests never wait on a reporter. Each thread's events arrive in
+     the order they happened, and RunFinished is always the last event. The reporters
+     are called from only the reporter thread, so they need no locking of their own.
+     If a reporter throws an exception, run() rethrows it once the tests have finished.
+
+     example:
+     @code
+     class FailureLogger : public Reporter {
+     public:
+         void report(const Event& event) override {
+             if (event.kind == Event::Kind::AssertionFailed) {
+                 std::clog << event.suite << ": " << event.testCase << ": " << event.message << std::endl;
+             }
+         }
+     };
+
+     int main(int argc, char* argv[]) {
+         kss::test::addReporter(std::make_shared<FailureLogger>());
+         return kss::test::run("My Test Program", argc, argv);
+     }
+     @endcode
+     */
+    class Reporter {
+    public:
+        enum class Status { Passed, Failed, Error, Skipped };
+
+        struct Event {
+            enum class Kind {
+                RunStarted,         // message is the name of the test run.
+                SuiteStarted,
+                AssertionFailed,    // message describes the failure.
+                CaseFinished,       // message is the first error, if there was one.
+                SuiteFinished,
+                RunFinished         // message is the name of the test run.
+            };
+
+            Kind                            kind = Kind::RunStarted;
+            std::string                     suite;
+            std::string                     testCase;
+            std::string                     message;
+            Status                          status = Status::Passed;    // Of the case, suite or run.
+            std::chrono::duration<double>   duration { 0 };             // Of the case, suite or run.
+        };
+
+        virtual ~Reporter() noexcept = default;
+        virtual void report(const Event& event) = 0;
+    };
+
+    /*!
+     Add a reporter that will receive the events of the test run. This must be called
+     before run().
+     */
+    void addReporter(std::shared_ptr<Reporter> reporter);
 }
 
 #endif
@@ -0,0 +1,141 @@
+//
+//  data_driven.cpp
+//  unittest
+//
+//  Created by Steven W. Klassen on 2026-10-18.
+//  Copyright © 2026 Klassen Software Solutions. All rights reserved.
+//  Licensing follows the MIT License.
+//
+
+#include <atomic>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <kss/test/all.h>
+
+#include "helpers.hpp"
+
+using namespace std;
+using namespace kss::test;
+using namespace helpers;
+
+namespace {
+    atomic<unsigned> csvRowsChecked { 0 };
+    atomic<unsigned> jsonRowsChecked { 0 };
+
+    // The data files must exist before run() is called, which the static initializers
+    // below ensure. A child process uses the files of its parent, whose directory is the
+    // child parameter, so that children that abort do not leave directories behind.
+    const auto dataDirectory = (isChild() ? nullptr : make_unique<TemporaryDirectory>("ksstest-data"));
+
+    string writeDataFile(const string& name, const string& contents) {
+        if (!dataDirectory) {
+            return (filesystem::path(childParameter()) / name).string();
+        }
+        return dataDirectory->write(name, contents);
+    }
+
+    const auto csvFilename = writeDataFile("vectors.csv",
+        "id,a,b,sum\r\n"
+        "one,1,2,3\r\n"
+        "two,10,20,30\r\n"
+        "\"quoted, with comma\",5,\"5\",10\r\n"
+        "\r\n"
+        ",0,0,0\r\n");
+
+    const auto jsonFilename = writeDataFile("vectors.jsonl",
+        "{\"name\": \"first\", \"text\": \"a\\\"b\", \"length\": 3}\n"
+        "{\"name\": \"second\", \"text\": \"\", \"length\": 0}\n"
+        "{\"length\": 3, \"text\": \"xyz\", \"name\": \"third\"}\n");
+
+    // Rows that each take a while, for "child data driven rows" below.
+    const auto slowRowsFilename = writeDataFile("slow.csv", [] {
+        string contents = "id\n";
+        for (unsigned i = 1; i <= 100; ++i) {
+            contents += "slow " + to_string(i) + "\n";
+        }
+        return contents;
+    }());
+
+    class DependentSuite : public TestSuite, public HasDependencies {
+    public:
+        DependentSuite(const string& name, vector<string> deps, test_case_list_t fns)
+        : TestSuite(name, fns), _deps(move(deps))
+        {}
+
+        vector<string> dependencies() const override {
+            return _deps;
+        }
+
+    private:
+        vector<string> _deps;
+    };
+}
+
+static DataDrivenTestSuite ts1("data driven csv", csvFilename, "id", [](const DataRow& row) {
+    KSS_ASSERT(stoi(row.at("a")) + stoi(row.at("b")) == stoi(row.at("sum")));
+    KSS_ASSERT(throwsException<out_of_range>([&]{ (void)row.at("missing"); }));
+
+    // Numbered by the line of the file, counting the header and the blank line.
+    const map<string, size_t> lineNumbers { { "one", 2 }, { "two", 3 }, { "quoted, with comma", 4 }, { "", 6 } };
+    KSS_ASSERT(row.number() == lineNumbers.at(row.at("id")));
+    ++csvRowsChecked;
+});
+
+static DataDrivenTestSuite ts2("data driven jsonl", jsonFilename, "name", [](const DataRow& row) {
+    KSS_ASSERT(row.at("text").size() == stoul(row.at("length")));
+    ++jsonRowsChecked;
+}, 2);
+
+static DependentSuite ts3("data driven results", { "data driven csv", "data driven jsonl" }, {
+    make_pair("every row was checked", [] {
+        KSS_ASSERT(csvRowsChecked == 4);
+        KSS_ASSERT(jsonRowsChecked == 3);
+    }),
+    make_pair("test case names", [] {
+        if (isChild()) { return; }      // The child runs this suite as well.
+        const TemporaryDirectory dir("ksstest-data");
+        const auto report = dir.filename("report.json");
+        const auto child = runChild("data driven", { "--json=" + report }, dataDirectory->path().string());
+        KSS_ASSERT(child.status == 0);
+
+        // Named by the key, or the line of the file if the key is empty, and a case of
+        // several rows by its first and last.
+        const auto json = readFile(report);
+        for (const auto* name : { "one", "two", "quoted, with comma", "row 6", "first to second", "third" }) {
+            KSS_ASSERT(statusInJsonReport(json, name) == "RUN");
+        }
+    }),
+    make_pair("waiting test cases are not charged for rows", [] {
+        if (isChild()) { return; }
+        const TemporaryDirectory dir("ksstest-data");
+        const auto report = dir.filename("report.json");
+        const auto child = runChild("child data driven", { "--json=" + report }, dataDirectory->path().string());
+        KSS_ASSERT(child.status == 0);
+
+        // The rows take a second in all, and a test case waiting on its own task while they
+        // run must not be given them to run.
+        const auto json = readFile(report);
+        KSS_ASSERT(statusInJsonReport(json, "slow 100") == "RUN");
+        KSS_ASSERT(stod(attributeInJsonReport(json, "waits on its own task", "time")) < 0.5);
+    })
+});
+
+// Run in a child process, at the same time, by "waiting test cases are not charged for
+// rows" above.
+static DataDrivenTestSuite childTs1("child data driven rows", slowRowsFilename, "id", [](const DataRow&) {
+    if (!isChild()) { return; }
+    this_thread::sleep_for(10ms);
+});
+
+static TestSuite childTs2("child data driven waiter", {
+    make_pair("waits on its own task", [] {
+        if (!isChild()) { return; }
+        this_thread::sleep_for(50ms);       // Until the rows are being run.
+        auto& ex = executor();
+        ex.wait(ex.submit([] { this_thread::sleep_for(10ms); }));
+    })
+});
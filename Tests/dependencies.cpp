@@ -0,0 +1,106 @@
+//
+//  dependencies.cpp
+//  unittest
+//
+//  Created by Steven W. Klassen on 2026-10-18.
+//  Copyright © 2026 Klassen Software Solutions. All rights reserved.
+//  Licensing follows the MIT License.
+//
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <kss/test/all.h>
+
+#include "helpers.hpp"
+
+using namespace std;
+using namespace kss::test;
+using namespace helpers;
+
+
+namespace {
+    atomic<bool> firstHasRun { false };
+    atomic<bool> secondHasRun { false };
+
+    class DependentSuite : public TestSuite, public HasDependencies {
+    public:
+        DependentSuite(const string& name, vector<string> deps, test_case_list_t fns)
+        : TestSuite(name, fns), _deps(move(deps))
+        {}
+
+        vector<string> dependencies() const override {
+            return _deps;
+        }
+
+    private:
+        vector<string> _deps;
+    };
+}
+
+// The names are chosen so that without the dependencies they would run in the
+// opposite order.
+static DependentSuite ts1("dependencies a", { "dependencies b", "dependencies c" }, {
+    make_pair("runs last", [] {
+        KSS_ASSERT(firstHasRun && secondHasRun);
+    })
+});
+
+static DependentSuite ts2("dependencies b", { "dependencies c" }, {
+    make_pair("runs second", [] {
+        KSS_ASSERT(firstHasRun);
+        secondHasRun = true;
+    })
+});
+
+static TestSuite ts3("dependencies c", {
+    make_pair("runs first", [] {
+        this_thread::sleep_for(20ms);
+        firstHasRun = true;
+        KSS_ASSERT(true);
+    })
+});
+
+static TestSuite ts4("dependencies failed prerequisite", {
+    make_pair("dependents are skipped", [] {
+        const TemporaryDirectory dir("ksstest-dependencies");
+        const auto report = dir.filename("report.json");
+        const auto child = runChild("child dependencies", { "--verbose", "--json=" + report });
+
+        // Only the prerequisite counts as failed, and both of its (direct and indirect)
+        // dependents name it as the reason that they were skipped.
+        KSS_ASSERT(child.status == 1);
+        KSS_ASSERT(contains(child.output, "Passed 0 of 3 test suites, 2 skipped, 1 failed."));
+        KSS_ASSERT(contains(child.output, "child dependencies b\n    SKIPPED since child dependencies a failed"));
+        KSS_ASSERT(contains(child.output, "child dependencies c\n    SKIPPED since child dependencies a failed"));
+
+        const auto json = readFile(report);
+        KSS_ASSERT(statusInJsonReport(json, "fails") == "RUN");
+        KSS_ASSERT(statusInJsonReport(json, "direct dependent") == "NOTRUN");
+        KSS_ASSERT(statusInJsonReport(json, "indirect dependent") == "NOTRUN");
+        KSS_ASSERT(attributeInJsonReport(json, "child dependencies b", "time") == "0.000000");
+        KSS_ASSERT(attributeInJsonReport(json, "child dependencies c", "time") == "0.000000");
+    })
+});
+
+// Run in a child process by "dependencies failed prerequisite" above.
+static TestSuite childTs1("child dependencies a", {
+    make_pair("fails", [] {
+        if (!isChild()) { return; }
+        KSS_ASSERT(false);
+    })
+});
+
+static DependentSuite childTs2("child dependencies b", { "child dependencies a" }, {
+    make_pair("direct dependent", [] {
+        KSS_ASSERT(true);
+    })
+});
+
+static DependentSuite childTs3("child dependencies c", { "child dependencies b" }, {
+    make_pair("indirect dependent", [] {
+        KSS_ASSERT(true);
+    })
+});
@@ -0,0 +1,120 @@
+//
+//  fixture_files.cpp
+//  unittest
+//
+//  Created by Steven W. Klassen on 2026-10-18.
+//  Copyright © 2026 Klassen Software Solutions. All rights reserved.
+//  Licensing follows the MIT License.
+//
+
+#include <algorithm>
+#include <filesystem>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+#include <kss/test/all.h>
+
+#include "helpers.hpp"
+
+using namespace std;
+using namespace kss::test;
+using namespace helpers;
+
+static TestSuite ts("fixture files", {
+    make_pair("fixtureFile", [] {
+        const TemporaryDirectory dir("ksstest-fixture");
+        const string contents = "some reference data\n";
+        const auto filename = dir.write("data.txt", contents);
+
+        auto a = fixtureFile(filename);
+        auto b = fixtureFile(filename, true);
+        KSS_ASSERT(a->view() == contents);
+        KSS_ASSERT(a == b);
+        KSS_ASSERT(a->path() == filesystem::canonical(filename).string());
+
+        // Once released it is mapped again on the next request.
+        const weak_ptr<const FixtureFile> released = a;
+        a.reset();
+        b.reset();
+        KSS_ASSERT(released.expired());
+        KSS_ASSERT(fixtureFile(filename)->size() == contents.size());
+
+        const auto empty = fixtureFile(dir.write("empty.txt", ""));
+        KSS_ASSERT(empty->size() == 0 && empty->view().empty());
+    }),
+    make_pair("cachedFixture", [] {
+        // The child builds and loads the fixtures, in a cache of its own.
+        const TemporaryDirectory cache("ksstest-fixture-cache");
+        const auto child = runChild("child cached fixture", { "--fixture-cache=" + cache.path().string() });
+        KSS_ASSERT(child.status == 0);
+
+        // The keys are escaped reversibly, and only the file of the latest inputs is kept.
+        vector<string> names;
+        for (const auto& entry : filesystem::directory_iterator(cache.path())) {
+            names.push_back(entry.path().filename().string());
+        }
+        sort(names.begin(), names.end());
+        KSS_ASSERT(names.size() == 2);
+        KSS_ASSERT(names.size() == 2 && names[0].rfind("squares%20%40%25@", 0) == 0);
+        KSS_ASSERT(names.size() == 2 && names[1].rfind("squares___@", 0) == 0);
+    }),
+    make_pair("missing fixtureFile", [] {
+        KSS_ASSERT(throwsException<system_error>([] {
+            (void)fixtureFile(TemporaryDirectory("ksstest-fixture").filename("missing.txt"));
+        }));
+    })
+});
+
+// Run in a child process, with a cache directory of its own, by "cachedFixture" above.
+static TestSuite childTs("child cached fixture", {
+    make_pair("cachedFixture", [] {
+        if (!isChild()) { return; }
+        const TemporaryDirectory dir("ksstest-fixture");
+        const string key = "squares @%";
+        unsigned builds = 0;
+        auto build = [&builds] {
+            ++builds;
+            vector<int> v;
+            for (int i = 0; i < 100; ++i) { v.push_back(i * i); }
+            return v;
+        };
+        auto serialize = [](const vector<int>& v, ostream& strm) {
+            strm.write(reinterpret_cast<const char*>(v.data()), streamsize(v.size() * sizeof(int)));
+        };
+        auto deserialize = [](const shared_ptr<const FixtureFile>& file) {
+            if (file->size() % sizeof(int) != 0) { throw runtime_error("truncated"); }
+            const auto* first = reinterpret_cast<const int*>(file->data());
+            return vector<int>(first, first + file->size() / sizeof(int));
+        };
+
+        const auto hash = hashOfFiles({ dir.write("inputs.txt", "version 1") });
+        const auto built = cachedFixture<vector<int>>(key, hash, build, serialize, deserialize);
+        const auto loaded = cachedFixture<vector<int>>(key, hash, build, serialize, deserialize);
+        KSS_ASSERT(builds == 1);
+        KSS_ASSERT(built.size() == 100 && built[9] == 81);
+        KSS_ASSERT(loaded == built);
+
+        const auto newHash = hashOfFiles({ dir.write("inputs.txt", "version 2") });
+        KSS_ASSERT(newHash != hash);
+        (void)cachedFixture<vector<int>>(key, newHash, build, serialize, deserialize);
+        KSS_ASSERT(builds == 2);
+
+        // A cache file that cannot be read is rebuilt.
+        (void)cachedFixture<vector<int>>(key, newHash, build, serialize, [](const shared_ptr<const FixtureFile>&) {
+            throw runtime_error("unreadable");
+            return vector<int>();
+        });
+        KSS_ASSERT(builds == 3);
+
+        // A key that differs only in the characters that cannot be in a filename is
+        // another fixture.
+        const auto other = cachedFixture<vector<int>>("squares___", newHash, [] { return vector<int>(1); },
+                                                      serialize, deserialize);
+        KSS_ASSERT(other.size() == 1);
+        KSS_ASSERT(cachedFixture<vector<int>>(key, newHash, build, serialize, deserialize).size() == 100);
+        KSS_ASSERT(builds == 3);
+    })
+});
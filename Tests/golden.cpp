@@ -0,0 +1,92 @@
+//
+//  golden.cpp
+//  unittest
+//
+//  Created by Steven W. Klassen on 2026-10-18.
+//  Copyright © 2026 Klassen Software Solutions. All rights reserved.
+//  Licensing follows the MIT License.
+//
+
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <kss/test/all.h>
+
+#include "helpers.hpp"
+
+using namespace std;
+using namespace kss::test;
+using namespace helpers;
+
+static TestSuite ts("golden", {
+    make_pair("matchesGoldenFile", [] {
+        const TemporaryDirectory dir("ksstest-golden");
+        const string contents = "line one\nline two\nline three\n";
+        const auto filename = dir.write("text.txt", contents);
+        KSS_ASSERT(matchesGoldenFile(filename, contents));
+        KSS_ASSERT(!matchesGoldenFile(filename, "line one\nline 2\nline three\n"));
+        KSS_ASSERT(!matchesGoldenFile(filename, "line one\n"));
+        KSS_ASSERT(!matchesGoldenFile(filename, contents + "line four\n"));
+        KSS_ASSERT(!matchesGoldenFile(dir.filename("missing.txt"), contents));
+
+        const auto empty = dir.write("empty.txt", "");
+        KSS_ASSERT(matchesGoldenFile(empty, ""));
+        KSS_ASSERT(!matchesGoldenFile(empty, "x"));
+
+        const string binary("\x00\x01\x02\xff", 4);
+        const auto binaryFilename = dir.write("binary.bin", binary);
+        KSS_ASSERT(matchesGoldenFile(binaryFilename, binary));
+        KSS_ASSERT(!matchesGoldenFile(binaryFilename, string("\x00\x01\x03\xff", 4)));
+    }),
+    make_pair("matchesGoldenFile stream", [] {
+        // Larger than a block so that the block boundaries are crossed.
+        const TemporaryDirectory dir("ksstest-golden");
+        string contents;
+        for (int i = 0; contents.size() < 3000000; ++i) {
+            contents += "line " + to_string(i) + "\n";
+        }
+        const auto filename = dir.write("large.txt", contents);
+        KSS_ASSERT(matchesGoldenFile(filename, contents));
+
+        istringstream same(contents);
+        KSS_ASSERT(matchesGoldenFile(filename, same));
+
+        string changed = contents;
+        changed[changed.size() - 3] = 'x';
+        istringstream different(changed);
+        KSS_ASSERT(!matchesGoldenFile(filename, different));
+        KSS_ASSERT(!matchesGoldenFile(filename, changed));
+
+        istringstream shorter(contents.substr(0, 1 << 20));
+        KSS_ASSERT(!matchesGoldenFile(filename, shorter));
+
+        istringstream longer(contents + "more");
+        KSS_ASSERT(!matchesGoldenFile(filename, longer));
+    }),
+    make_pair("--update-golden", [] {
+        const TemporaryDirectory dir("ksstest-golden");
+        const auto stale = dir.write("stale.txt", "old contents\n");
+        const auto missing = dir.filename("missing.txt");
+        KSS_ASSERT(runChild("child golden", {}, dir.path().string()).status != 0);
+        KSS_ASSERT(matchesGoldenFile(stale, "old contents\n"));
+
+        KSS_ASSERT(runChild("child golden", { "--update-golden" }, dir.path().string()).status == 0);
+        KSS_ASSERT(matchesGoldenFile(stale, "new contents\n"));
+        KSS_ASSERT(matchesGoldenFile(missing, "streamed contents\n"));
+        KSS_ASSERT(runChild("child golden", {}, dir.path().string()).status == 0);
+    })
+});
+
+// Run in a child process by "--update-golden" above, with the golden files in the
+// directory given by the child parameter.
+static TestSuite childTs("child golden", {
+    make_pair("matchesGoldenFile", [] {
+        if (!isChild()) { return; }
+        const filesystem::path dir = childParameter();
+        KSS_ASSERT(matchesGoldenFile((dir / "stale.txt").string(), "new contents\n"));
+
+        istringstream strm("streamed contents\n");
+        KSS_ASSERT(matchesGoldenFile((dir / "missing.txt").string(), strm));
+    })
+});
@@ -0,0 +1,289 @@
+//
+//  helpers.cpp
+//  unittest
+//
+//  Created by Steven W. Klassen on 2026-10-18.
+//  Copyright © 2026 Klassen Software Solutions. All rights reserved.
+//  Licensing follows the MIT License.
+//
+
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <system_error>
+
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#if defined(__APPLE__)
+#   include <mach-o/dyld.h>
+#endif
+
+#include "helpers.hpp"
+
+using namespace std;
+using namespace helpers;
+
+extern char** environ;
+
+namespace {
+    const char* childEnvironmentVariable = "KSSTEST_UNITTEST_CHILD";
+
+    filesystem::path programPath() {
+#if defined(__APPLE__)
+        char buffer[PATH_MAX];
+        uint32_t size = sizeof(buffer);
+        if (_NSGetExecutablePath(buffer, &size) != 0) {
+            throw system_error(ENAMETOOLONG, system_category(), "_NSGetExecutablePath");
+        }
+        return filesystem::canonical(buffer);
+#else
+        return filesystem::read_symlink("/proc/self/exe");
+#endif
+    }
+
+    // A recursive descent JSON validator.
+    class JsonValidator {
+    public:
+        explicit JsonValidator(const string& text) : _text(text) {}
+
+        bool isValid() {
+            return value() && (skipSpace(), _pos == _text.size());
+        }
+
+    private:
+        const string&   _text;
+        size_t          _pos = 0;
+
+        void skipSpace() noexcept {
+            while (_pos < _text.size() && (_text[_pos] == ' ' || _text[_pos] == '\t'
+                                           || _text[_pos] == '\r' || _text[_pos] == '\n'))
+            {
+                ++_pos;
+            }
+        }
+
+        bool consume(char ch) noexcept {
+            skipSpace();
+            if (_pos < _text.size() && _text[_pos] == ch) {
+                ++_pos;
+                return true;
+            }
+            return false;
+        }
+
+        bool digits() noexcept {
+            const auto start = _pos;
+            while (_pos < _text.size() && isdigit((unsigned char)_text[_pos])) { ++_pos; }
+            return _pos > start;
+        }
+
+        bool literal(const char* s) noexcept {
+            const auto len = strlen(s);
+            if (_text.compare(_pos, len, s) != 0) {
+                return false;
+            }
+            _pos += len;
+            return true;
+        }
+
+        bool number() noexcept {
+            if (_pos < _text.size() && _text[_pos] == '-') { ++_pos; }
+            if (_pos < _text.size() && _text[_pos] == '0') { ++_pos; }
+            else if (!digits()) { return false; }
+            if (_pos < _text.size() && _text[_pos] == '.') {
+                ++_pos;
+                if (!digits()) { return false; }
+            }
+            if (_pos < _text.size() && (_text[_pos] == 'e' || _text[_pos] == 'E')) {
+                ++_pos;
+                if (_pos < _text.size() && (_text[_pos] == '+' || _text[_pos] == '-')) { ++_pos; }
+                if (!digits()) { return false; }
+            }
+            return true;
+        }
+
+        bool str() noexcept {
+            if (!consume('"')) {
+                return false;
+            }
+            while (_pos < _text.size() && _text[_pos] != '"') {
+                const auto ch = (unsigned char)_text[_pos++];
+                if (ch < 0x20) {
+                    return false;
+                }
+                if (ch == '\\') {
+                    if (_pos >= _text.size()) { return false; }
+                    const auto esc = _text[_pos++];
+                    if (esc == 'u') {
+                        for (int i = 0; i < 4; ++i, ++_pos) {
+                            if (_pos >= _text.size() || !isxdigit((unsigned char)_text[_pos])) { return false; }
+                        }
+                    }
+                    else if (esc == '\0' || strchr("\"\\/bfnrt", esc) == nullptr) {
+                        return false;
+                    }
+                }
+            }
+            return consume('"');
+        }
+
+        bool value() noexcept {
+            skipSpace();
+            if (_pos >= _text.size()) {
+                return false;
+            }
+            switch (_text[_pos]) {
+                case '{':
+                    ++_pos;
+                    if (consume('}')) { return true; }
+                    do {
+                        if (!str() || !consume(':') || !value()) { return false; }
+                    } while (consume(','));
+                    return consume('}');
+                case '[':
+                    ++_pos;
+                    if (consume(']')) { return true; }
+                    do {
+                        if (!value()) { return false; }
+                    } while (consume(','));
+                    return consume(']');
+                case '"':
+                    return str();
+                case 't':
+                    return literal("true");
+                case 'f':
+                    return literal("false");
+                case 'n':
+                    return literal("null");
+                default:
+                    return number();
+            }
+        }
+    };
+}
+
+TemporaryDirectory::TemporaryDirectory(const string& prefix) : _owner(getpid()) {
+    static atomic<unsigned> counter { 0 };
+    _path = filesystem::temp_directory_path()
+        / (prefix + "-" + to_string(getpid()) + "-" + to_string(++counter));
+    filesystem::remove_all(_path);
+    filesystem::create_directories(_path);
+}
+
+TemporaryDirectory::~TemporaryDirectory() noexcept {
+    if (getpid() == _owner) {
+        error_code ec;
+        filesystem::remove_all(_path, ec);
+    }
+}
+
+string TemporaryDirectory::filename(const string& name) const {
+    return (_path / name).string();
+}
+
+string TemporaryDirectory::write(const string& name, const string& contents) const {
+    const auto fname = filename(name);
+    ofstream strm(fname, ios::binary);
+    strm << contents;
+    if (!strm) {
+        throw system_error(errno, system_category(), "unable to write " + fname);
+    }
+    return fname;
+}
+
+string helpers::readFile(const string& filename) {
+    ifstream strm(filename, ios::binary);
+    return string(istreambuf_iterator<char>(strm), istreambuf_iterator<char>());
+}
+
+bool helpers::isValidJson(const string& text) {
+    return JsonValidator(text).isValid();
+}
+
+string helpers::attributeInJsonReport(const string& json, const string& name, const string& attribute) {
+    const auto pos = json.find("\"name\": \"" + name + "\"");
+    if (pos == string::npos) {
+        return string();
+    }
+    const string key = "\"" + attribute + "\": ";
+    const auto first = json.find(key, pos);
+    if (first == string::npos) {
+        return string();
+    }
+    const auto start = first + key.size();
+    if (start < json.size() && json[start] == '"') {
+        return json.substr(start + 1, json.find('"', start + 1) - start - 1);
+    }
+    return json.substr(start, json.find_first_of(",\n}", start) - start);
+}
+
+string helpers::statusInJsonReport(const string& json, const string& testCaseName) {
+    return attributeInJsonReport(json, testCaseName, "status");
+}
+
+ChildRun helpers::runChild(const string& filter,
+                           const vector<string>& arguments,
+                           const string& parameter)
+{
+    const TemporaryDirectory dir("ksstest-child");
+    const auto outputFilename = dir.filename("output.txt");
+    const auto program = programPath().string();
+
+    vector<string> args { program, "--filter=" + filter };
+    args.insert(args.end(), arguments.begin(), arguments.end());
+    vector<char*> argv;
+    for (auto& arg : args) {
+        argv.push_back(arg.data());
+    }
+    argv.push_back(nullptr);
+
+    vector<string> env { string(childEnvironmentVariable) + "=" + parameter };
+    for (char** e = environ; *e != nullptr; ++e) {
+        env.push_back(*e);
+    }
+    vector<char*> envp;
+    for (auto& e : env) {
+        envp.push_back(e.data());
+    }
+    envp.push_back(nullptr);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, outputFilename.c_str(),
+                                     O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO, STDERR_FILENO);
+    pid_t pid = 0;
+    const int err = posix_spawn(&pid, program.c_str(), &actions, nullptr, argv.data(), envp.data());
+    posix_spawn_file_actions_destroy(&actions);
+    if (err != 0) {
+        throw system_error(err, system_category(), "posix_spawn " + program);
+    }
+
+    int status = 0;
+    while (waitpid(pid, &status, 0) == -1) {
+        if (errno != EINTR) {
+            throw system_error(errno, system_category(), "waitpid");
+        }
+    }
+
+    ChildRun ret;
+    ret.status = (WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+    ret.output = readFile(outputFilename);
+    return ret;
+}
+
+bool helpers::isChild() noexcept {
+    return getenv(childEnvironmentVariable) != nullptr;
+}
+
+string helpers::childParameter() {
+    const char* value = getenv(childEnvironmentVariable);
+    return (value ? value : "");
+}
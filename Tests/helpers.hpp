@@ -0,0 +1,90 @@
+//
+//  helpers.hpp
+//  unittest
+//
+//  Created by Steven W. Klassen on 2026-10-18.
+//  Copyright © 2026 Klassen Software Solutions. All rights reserved.
+//  Licensing follows the MIT License.
+//
+
+#ifndef ksstest_unittest_helpers_hpp
+#define ksstest_unittest_helpers_hpp
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+namespace helpers {
+
+    // A uniquely named directory under the system temporary directory. It, and everything
+    // written to it, is removed when the object is destroyed, unless that happens in a
+    // forked child (e.g. a death test calling exit) rather than the process that made it.
+    class TemporaryDirectory {
+    public:
+        explicit TemporaryDirectory(const std::string& prefix);
+        ~TemporaryDirectory() noexcept;
+
+        TemporaryDirectory(const TemporaryDirectory&) = delete;
+        TemporaryDirectory& operator=(const TemporaryDirectory&) = delete;
+
+        const std::filesystem::path& path() const noexcept { return _path; }
+
+        // Returns the name of a file in the directory, without creating it.
+        std::string filename(const std::string& name) const;
+
+        // Writes a file in the directory and returns its name.
+        std::string write(const std::string& name, const std::string& contents) const;
+
+    private:
+        std::filesystem::path _path;
+        pid_t                 _owner;
+    };
+
+    // Returns the contents of a file, or an empty string if it cannot be read.
+    std::string readFile(const std::string& filename);
+
+    inline bool contains(const std::string& s, const std::string& substr) {
+        return s.find(substr) != std::string::npos;
+    }
+
+    // Returns true if the text is a single valid JSON value (RFC 8259), optionally surrounded
+    // by whitespace.
+    bool isValidJson(const std::string& text);
+
+    // Returns the value, as written but without quotes, of an attribute of the object with
+    // the given name in a JSON report, or an empty string if it is not there. If more than
+    // one object has the name, the first is used. The attributes of each object are written
+    // in alphabetical order, so only those after "name" can be found.
+    std::string attributeInJsonReport(const std::string& json, const std::string& name,
+                                      const std::string& attribute);
+
+    // Returns the status ("RUN" or "NOTRUN") of a test case in a JSON report, or an empty
+    // string if it is not there. If more than one test case has the name, the first is used.
+    std::string statusInJsonReport(const std::string& json, const std::string& testCaseName);
+
+    // How a run of this program in a child process ended.
+    struct ChildRun {
+        int         status = -1;    // The exit status, or -1 if it did not exit normally.
+        std::string output;         // Everything the child wrote to stdout and stderr.
+    };
+
+    // Runs this test program again in a child process, restricted to the test suites whose
+    // names start with filter, with the additional command line arguments. This is how the
+    // command line options, and tests that must fail, are tested. The parameter is made
+    // available to the child by childParameter.
+    ChildRun runChild(const std::string& filter,
+                      const std::vector<std::string>& arguments = {},
+                      const std::string& parameter = std::string());
+
+    // Returns true if this process was started by runChild. The test suites that exist only
+    // to be run by runChild (by convention their names start with "child") return without
+    // doing anything otherwise.
+    bool isChild() noexcept;
+
+    // Returns the parameter given to runChild, in the child process.
+    std::string childParameter();
+}
+
+#endif
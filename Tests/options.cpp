@@ -0,0 +1,360 @@
+//
+//  options.cpp
+//  unittest
+//
+//  Created by Steven W. Klassen on 2026-10-18.
+//  Copyright © 2026 Klassen Software Solutions. All rights reserved.
+//  Licensing follows the MIT License.
+//
+
+#include <atomic>
+#include <cmath>
+#include <ctime>
+#include <sstream>
+#include <string>
+#include <kss/test/all.h>
+
+#if defined(__linux__)
+#   include <sched.h>
+#endif
+
+#include "helpers.hpp"
+
+using namespace std;
+using namespace kss::test;
+using namespace helpers;
+
+
+// Tests of the command line options, each of which runs one or more of the "child"
+// suites below in a child process with the option given.
+
+namespace {
+    atomic<unsigned> flakyAttempts { 0 };
+
+    // Returns true if first appears in s, and second appears after it.
+    bool appearsBefore(const string& s, const string& first, const string& second) {
+        const auto pos = s.find(first);
+        return pos != string::npos && s.find(second, pos + first.size()) != string::npos;
+    }
+
+    // Returns the category of the first complete ("X") event in a trace with the given
+    // name, or an empty string if there is none. Each event is on a line of its own.
+    string categoryOfTraceEvent(const string& trace, const string& name) {
+        const auto pos = trace.find("{\"name\": \"" + name + "\", \"ph\": \"X\"");
+        if (pos == string::npos) {
+            return string();
+        }
+        const auto line = trace.substr(pos, trace.find('\n', pos) - pos);
+        const string key = "\"cat\": \"";
+        const auto first = line.find(key);
+        if (first == string::npos) {
+            return string();
+        }
+        const auto start = first + key.size();
+        return line.substr(start, line.find('"', start) - start);
+    }
+
+    class AfterAllSuite : public TestSuite, public HasAfterAll {
+    public:
+        AfterAllSuite(const string& name, test_case_list_t fns) : TestSuite(name, fns) {}
+
+        void afterAll() override {
+            KSS_ASSERT(true);
+        }
+    };
+
+    class FixturesSuite : public TestSuite, public HasBeforeAll, public HasBeforeEach {
+    public:
+        FixturesSuite(const string& name, test_case_list_t fns) : TestSuite(name, fns) {}
+
+        void beforeAll() override {
+            KSS_ASSERT(true);
+        }
+
+        void beforeEach() override {
+            KSS_ASSERT(true);
+        }
+    };
+}
+
+static TestSuite ts("options", {
+    make_pair("--stop-on-first-failure", [] {
+        const TemporaryDirectory dir("ksstest-options");
+        const auto report = dir.filename("report.json");
+        const auto child = runChild("child cancel", {
+            "--stop-on-first-failure", "--no-parallel", "--json=" + report
+        });
+        KSS_ASSERT(child.status == 1);
+        KSS_ASSERT(contains(child.output, "Stopped early due to --stop-on-first-failure"));
+
+        // The test case after the failure is not started, the AfterAll still cleans up, and
+        // the next suite is not run.
+        const auto json = readFile(report);
+        KSS_ASSERT(statusInJsonReport(json, "1 fails") == "RUN");
+        KSS_ASSERT(statusInJsonReport(json, "2 not started") == "NOTRUN");
+        KSS_ASSERT(statusInJsonReport(json, "AfterAll") == "RUN");
+        KSS_ASSERT(statusInJsonReport(json, "not started") == "NOTRUN");
+        KSS_ASSERT(attributeInJsonReport(json, "child cancel b", "time") == "0.000000");
+        KSS_ASSERT(attributeInJsonReport(json, "not started", "time") == "0.000000");
+    }),
+    make_pair("--failed-first", [] {
+        const TemporaryDirectory dir("ksstest-options");
+        const auto failedFirst = "--failed-first=" + dir.filename("failed.txt");
+
+        // Without the file the suites are run in name order.
+        auto child = runChild("child failed first", { failedFirst, "--verbose" }, "fail");
+        KSS_ASSERT(child.status != 0);
+        KSS_ASSERT(appearsBefore(child.output, "child failed first a", "child failed first b"));
+        KSS_ASSERT(readFile(dir.filename("failed.txt")) == "child failed first b\n");
+
+        child = runChild("child failed first", { failedFirst, "--verbose" });
+        KSS_ASSERT(child.status == 0);
+        KSS_ASSERT(appearsBefore(child.output, "child failed first b", "child failed first a"));
+        KSS_ASSERT(readFile(dir.filename("failed.txt")).empty());
+    }),
+    make_pair("--retries", [] {
+        const TemporaryDirectory dir("ksstest-options");
+        const auto report = dir.filename("report.xml");
+
+        // The flaky test case is listed, with the failures of its earlier attempts, in
+        // verbose mode as well as the default one.
+        const string flaky = "  Flaky:\n    child flaky: fails twice passed on retry 2\n"
+            "      options.cpp: ";
+        for (const auto& mode : { "--no-parallel", "--verbose" }) {
+            const auto child = runChild("child flaky", { "--retries=3", mode, "--xml=" + report });
+            KSS_ASSERT(child.status == 1);
+            KSS_ASSERT(contains(child.output, flaky));
+            KSS_ASSERT(contains(child.output, "↳expected (3), actual was (1)\n      options.cpp: "));
+            KSS_ASSERT(contains(child.output, "↳expected (3), actual was (2)\n"));
+
+            const auto xml = readFile(report);
+            KSS_ASSERT(contains(xml, "flaky=\"1\""));
+            KSS_ASSERT(appearsBefore(xml, "name=\"fails twice\"", "<flakyFailure message=\"options.cpp: "));
+            KSS_ASSERT(contains(xml, "flaky=\"true\""));
+            KSS_ASSERT(contains(xml, "retries=\"3\""));
+        }
+    }),
+    make_pair("--rerun-failed", [] {
+        // The names are written to the reports, and read back, with escapes.
+        const TemporaryDirectory dir("ksstest-options");
+        const auto xml = dir.filename("report.xml");
+        const auto json = dir.filename("report.json");
+        auto child = runChild("child rerun", { "--xml=" + xml, "--json=" + json }, "fail");
+        KSS_ASSERT(child.status == 3);
+        for (const auto& report : { xml, json }) {
+            child = runChild("child rerun", { "--rerun-failed=" + report });
+            KSS_ASSERT(child.status == 0);
+            KSS_ASSERT(contains(child.output, "\n    quotes \"double\" 'single' & <angle> ."));
+            KSS_ASSERT(contains(child.output, "\n    backslash \\ tab\t snowman \u2603 ."));
+            KSS_ASSERT(contains(child.output, "\n    escaped <angle> & \u2603 A ."));
+            KSS_ASSERT(!contains(child.output, "\n    passes "));
+        }
+
+        // Reports written by other tools may use escapes that ours do not.
+        const auto otherXml = dir.write("other.xml",
+            "<?xml version=\"1.0\"?>\n<!-- written by hand -->\n<testsuites>\n"
+            "  <testsuite name='child rerun'>\n"
+            "    <testcase name=\"escaped &lt;angle&gt; &amp; &#x2603; &#65;\"><failure/></testcase>\n"
+            "    <testcase name=\"passes\"><system-out><![CDATA[<failure/>]]></system-out></testcase>\n"
+            "  </testsuite>\n</testsuites>\n");
+        const auto otherJson = dir.write("other.json",
+            "{\"testsuites\": [{\"name\": \"child rerun\", \"testsuite\": [\n"
+            "  {\"name\": \"escaped <angle> & \\u2603 \\u0041\", \"failures\": [{\"message\": \"\\\"\\/\\n\"}]},\n"
+            "  {\"name\": \"passes\", \"time\": 0.5, \"flaky\": false}\n"
+            "]}]}\n");
+        for (const auto& report : { otherXml, otherJson }) {
+            child = runChild("child rerun", { "--rerun-failed=" + report });
+            KSS_ASSERT(child.status == 0);
+            KSS_ASSERT(contains(child.output, "\n    escaped <angle> & \u2603 A ."));
+            KSS_ASSERT(!contains(child.output, "\n    quotes "));
+            KSS_ASSERT(!contains(child.output, "\n    passes "));
+        }
+
+        // Malformed reports are rejected.
+        const auto badXml = dir.write("bad.xml", "<testsuites><testsuite name=\"child rerun\">");
+        child = runChild("child rerun", { "--rerun-failed=" + badXml });
+        KSS_ASSERT(child.status != 0);
+        KSS_ASSERT(contains(child.output, "invalid_argument"));
+        KSS_ASSERT(contains(child.output, "Malformed XML at offset"));
+
+        const auto badJson = dir.write("bad.json", "{\"testsuites\": [{\"name\": \"child rerun\",}]}");
+        child = runChild("child rerun", { "--rerun-failed=" + badJson });
+        KSS_ASSERT(child.status != 0);
+        KSS_ASSERT(contains(child.output, "invalid_argument"));
+        KSS_ASSERT(contains(child.output, "Malformed JSON at offset"));
+    }),
+    make_pair("--trace", [] {
+        const TemporaryDirectory dir("ksstest-options");
+        const auto filename = dir.filename("trace.json");
+        const auto child = runChild("child trace", { "--trace=" + filename });
+        KSS_ASSERT(child.status == 0);
+
+        const auto trace = readFile(filename);
+        KSS_ASSERT(isValidJson(trace));
+        KSS_ASSERT(categoryOfTraceEvent(trace, "child trace") == "suite");
+        KSS_ASSERT(categoryOfTraceEvent(trace, "BeforeAll") == "fixture");
+        KSS_ASSERT(categoryOfTraceEvent(trace, "beforeEach") == "fixture");
+        KSS_ASSERT(categoryOfTraceEvent(trace, "traced \\\"case\\\"") == "case");
+        KSS_ASSERT(categoryOfTraceEvent(trace, "summary") == "report");
+
+        KSS_ASSERT(isValidJson("{\"a\": [1, -2.5e3, true, null, \"\\u00e9\\n\"], \"b\": {}}"));
+        KSS_ASSERT(!isValidJson("{\"a\": [1, 2,]}"));
+        KSS_ASSERT(!isValidJson("{\"a\": 1} {}"));
+    }),
+    make_pair("--pin-cpu and --cold-cache", [] {
+        const TemporaryDirectory dir("ksstest-options");
+        const auto report = dir.filename("report.xml");
+        auto child = runChild("child timing", { "--pin-cpu", "--cold-cache", "--xml=" + report });
+        KSS_ASSERT(child.status == 0);
+
+        // The environment is recorded in the root of the report.
+        auto xml = readFile(report);
+        const auto root = xml.substr(0, xml.find('>', xml.find("<testsuites")));
+        KSS_ASSERT(contains(root, "coldCache=\"true\""));
+        KSS_ASSERT(contains(root, "pinnedCpu=\"current\""));
+#if defined(__linux__)
+        KSS_ASSERT(contains(root, "loadAverage=\""));
+#endif
+
+        child = runChild("child timing", { "--pin-cpu=0", "--xml=" + report });
+        KSS_ASSERT(child.status == 0);
+        xml = readFile(report);
+        KSS_ASSERT(contains(xml, "pinnedCpu=\"0\""));
+        KSS_ASSERT(!contains(xml, "coldCache="));
+    }),
+    make_pair("--profile", [] {
+        const TemporaryDirectory dir("ksstest-options");
+        const auto child = runChild("child profile", { "--profile=" + dir.path().string() });
+        KSS_ASSERT(child.status == 0);
+
+        // Suites whose names differ only in punctuation are written to their own files.
+        KSS_ASSERT(!readFile(dir.filename("child%20profile%20a%20b.folded")).empty());
+        KSS_ASSERT(!readFile(dir.filename("child%20profile%20a_b.folded")).empty());
+
+        // Every stack starts with the test case and ends with the number of samples.
+        const auto folded = readFile(dir.filename("child%20profile.folded"));
+        KSS_ASSERT(!folded.empty());
+        istringstream strm(folded);
+        string line;
+        while (getline(strm, line)) {
+            KSS_ASSERT(line.rfind("busy;", 0) == 0);
+            const auto count = line.substr(line.rfind(' ') + 1);
+            KSS_ASSERT(!count.empty() && count.find_first_not_of("0123456789") == string::npos);
+        }
+    })
+});
+
+
+static AfterAllSuite childTs1("child cancel a", {
+    make_pair("1 fails", [] {
+        if (!isChild()) { return; }
+        KSS_ASSERT(false);
+    }),
+    make_pair("2 not started", [] {
+        KSS_ASSERT(true);
+    })
+});
+
+static TestSuite childTs2("child cancel b", {
+    make_pair("not started", [] {
+        KSS_ASSERT(true);
+    })
+});
+
+// The b suite fails if the child parameter is "fail".
+static TestSuite childTs3("child failed first a", {
+    make_pair("passes", [] {
+        KSS_ASSERT(true);
+    })
+});
+
+static TestSuite childTs4("child failed first b", {
+    make_pair("may fail", [] {
+        KSS_ASSERT(childParameter() != "fail");
+    })
+});
+
+// The test cases other than "passes" fail if the child parameter is "fail".
+static TestSuite childTs6("child rerun", {
+    make_pair("passes", [] {
+        KSS_ASSERT(true);
+    }),
+    make_pair("quotes \"double\" 'single' & <angle>", [] {
+        KSS_ASSERT(childParameter() != "fail");
+    }),
+    make_pair("backslash \\ tab\t snowman \u2603", [] {
+        KSS_ASSERT(childParameter() != "fail");
+    }),
+    make_pair("escaped <angle> & \u2603 A", [] {
+        KSS_ASSERT(childParameter() != "fail");
+    })
+});
+
+static TestSuite childTs5("child flaky", {
+    make_pair("always fails", [] {
+        KSS_ASSERT(!isChild());
+    }),
+    make_pair("fails twice", [] {
+        if (!isChild()) { return; }
+        const unsigned attempt = ++flakyAttempts;
+        KSS_ASSERT(isEqualTo<unsigned>(3, [attempt] { return attempt; }));
+    })
+});
+
+static FixturesSuite childTs7("child trace", {
+    make_pair("traced \"case\"", [] {
+        KSS_ASSERT(true);
+    })
+});
+
+// Uses enough CPU time to be sampled by the profiler.
+static void busy() {
+    if (!isChild()) { return; }
+    const auto start = clock();
+    volatile double x = 0.0;
+    while (clock() - start < CLOCKS_PER_SEC / 10) {
+        for (int i = 0; i < 1000; ++i) { x = x + sqrt(double(i)); }
+    }
+}
+
+static TestSuite childTs8("child profile", {
+    make_pair("busy", busy)
+});
+
+static TestSuite childTs8a("child profile a b", {
+    make_pair("busy", busy)
+});
+
+static TestSuite childTs8b("child profile a_b", {
+    make_pair("busy", busy)
+});
+
+// The timed code is run on a single CPU when --pin-cpu is given, and the affinity is
+// restored afterwards.
+static TestSuite childTs9("child timing", {
+    make_pair("pinned", [] {
+        if (!isChild()) { return; }
+        KSS_ASSERT(completesWithin(10s, []{
+            unsigned sum = 0;
+            for (unsigned i = 0; i < 1000; ++i) {
+                sum += i;
+                doNotOptimize(sum);
+            }
+        }));
+#if defined(__linux__)
+        cpu_set_t before;
+        KSS_ASSERT(sched_getaffinity(0, sizeof(before), &before) == 0);
+        int numberOfCpus = 0;
+        KSS_ASSERT(completesWithin(10s, [&numberOfCpus] {
+            cpu_set_t cpus;
+            if (sched_getaffinity(0, sizeof(cpus), &cpus) == 0) {
+                numberOfCpus = CPU_COUNT(&cpus);
+            }
+        }));
+        KSS_ASSERT(numberOfCpus == 1);
+        cpu_set_t after;
+        KSS_ASSERT(sched_getaffinity(0, sizeof(after), &after) == 0);
+        KSS_ASSERT(CPU_EQUAL(&before, &after));
+#endif
+    })
+});
@@ -0,0 +1,174 @@
+//
+//  ranges.cpp
+//  unittest
+//
+//  Created by Steven W. Klassen on 2026-10-18.
+//  Copyright © 2026 Klassen Software Solutions. All rights reserved.
+//  Licensing follows the MIT License.
+//
+
+#include <array>
+#include <cmath>
+#include <limits>
+#include <list>
+#include <numeric>
+#include <string>
+#include <vector>
+#include <kss/test/all.h>
+
+#include "helpers.hpp"
+
+using namespace std;
+using namespace kss::test;
+using namespace helpers;
+
+namespace {
+    struct NotStreamable {
+        int i;
+        bool operator==(const NotStreamable& rhs) const noexcept { return i == rhs.i; }
+    };
+}
+
+static TestSuite ts("ranges", {
+    make_pair("KSS_ASSERT_ALL", [] {
+        vector<int> v(1000);
+        iota(v.begin(), v.end(), 0);
+        KSS_ASSERT_ALL(v, [](int i) { return i >= 0; });
+        KSS_ASSERT_ALL(list<int>({ 1, 2, 3 }), [](int i) { return i > 0; });
+        KSS_ASSERT_ALL(vector<int>(), [](int) { return false; });
+
+        const int limit = 1000;
+        const int offset = 0;
+        KSS_ASSERT_ALL(v, [limit, offset](int i) { return i + offset < limit; });
+
+        KSS_ASSERT(!allElementsSatisfy(v, [](int i) { return i % 100 != 0; }));
+        KSS_ASSERT(!allElementsSatisfy(list<int>({ 1, -2, 3 }), [](int i) { return i > 0; }));
+    }),
+    make_pair("KSS_ASSERT_ALL large", [] {
+        // Large enough to be split across the executor.
+        vector<unsigned> v(3'000'000);
+        iota(v.begin(), v.end(), 0U);
+        KSS_ASSERT_ALL(v, [](unsigned i) { return i < 3'000'000U; });
+
+        v[2'999'999] = 5'000'000;
+        v[17] = 5'000'000;
+        KSS_ASSERT(!allElementsSatisfy(v, [](unsigned i) { return i < 3'000'000U; }));
+    }),
+    make_pair("KSS_ASSERT_EQUAL_RANGES", [] {
+        vector<int> a(10000);
+        iota(a.begin(), a.end(), 0);
+        vector<int> b = a;
+        KSS_ASSERT_EQUAL_RANGES(a, b);
+        KSS_ASSERT_EQUAL_RANGES(string("hello"), string("hello"));
+        KSS_ASSERT_EQUAL_RANGES((array<int, 3>{ 1, 2, 3 }), (list<int>{ 1, 2, 3 }));
+        KSS_ASSERT_EQUAL_RANGES((vector<double>{ 0.0, 1.5 }), (vector<double>{ -0.0, 1.5 }));
+        KSS_ASSERT_EQUAL_RANGES((vector<NotStreamable>{ { 1 }, { 2 } }),
+                                (vector<NotStreamable>{ { 1 }, { 2 } }));
+
+        b[5000] = -1;
+        KSS_ASSERT(!rangesAreEqual(a, b));
+        KSS_ASSERT(!rangesAreEqual(a, vector<int>(a.begin(), a.end() - 1)));
+        KSS_ASSERT(!rangesAreEqual(vector<NotStreamable>{ { 1 } }, vector<NotStreamable>{ { 2 } }));
+        KSS_ASSERT(!rangesAreEqual(list<int>{ 1, 2 }, list<int>{ 1, 3 }));
+    }),
+    make_pair("KSS_ASSERT_EQUAL_RANGES large", [] {
+        vector<uint64_t> a(2'000'000);
+        iota(a.begin(), a.end(), uint64_t(0));
+        vector<uint64_t> b = a;
+        KSS_ASSERT_EQUAL_RANGES(a, b);
+
+        for (size_t i = 100; i < b.size(); i += 100'000) {
+            b[i] = 0;
+        }
+        KSS_ASSERT(!rangesAreEqual(a, b));
+    }),
+    make_pair("rangesAreClose", [] {
+        vector<float> expected(1000);
+        for (size_t i = 0; i < expected.size(); ++i) {
+            expected[i] = float(i + 1) * 1e6f;
+        }
+        vector<float> actual = expected;
+        for (auto& f : actual) {
+            f = nextafter(f, numeric_limits<float>::infinity());
+        }
+        KSS_ASSERT(rangesAreClose(expected, actual));
+        KSS_ASSERT(!rangesAreClose(expected, actual, FloatTolerance{ 0.0, 0.0, 0 }));
+        KSS_ASSERT(rangesAreClose(expected, actual, FloatTolerance{ 0.0, 1e-6, 0 }));
+
+        const double nan = numeric_limits<double>::quiet_NaN();
+        const double inf = numeric_limits<double>::infinity();
+        KSS_ASSERT(rangesAreClose(vector<double>{ 0.0, nan, inf, -inf }, vector<double>{ -0.0, nan, inf, -inf }));
+        KSS_ASSERT(!rangesAreClose(vector<double>{ 1.0 }, vector<double>{ nan }));
+        KSS_ASSERT(!rangesAreClose(vector<double>{ inf }, vector<double>{ numeric_limits<double>::max() },
+                                   FloatTolerance{ 0.0, 1.0 }));
+        KSS_ASSERT(!rangesAreClose(vector<double>{ 1.0, 2.0 }, vector<double>{ 1.0 }));
+        KSS_ASSERT(rangesAreClose(vector<double>{ 1e-12 }, vector<double>{ 0.0 }, FloatTolerance{ 1e-9 }));
+    }),
+    make_pair("rangesAreClose large", [] {
+        vector<double> expected(2'000'000, 1.0);
+        vector<double> actual = expected;
+        KSS_ASSERT(rangesAreClose(expected, actual));
+        actual[1'999'999] = 1.5;
+        actual[3] = 1.0000001;
+        KSS_ASSERT(!rangesAreClose(expected, actual, FloatTolerance{ 0.0, 1e-9 }));
+    }),
+    make_pair("isCloseTo with FloatTolerance", [] {
+        KSS_ASSERT(isCloseTo<double>(1e20, FloatTolerance{ 0.0, 1e-9 }, [] { return 1e20 + 1e5; }));
+        KSS_ASSERT(!isCloseTo<double>(1e20, FloatTolerance{ 1.0, 0.0, 0 }, [] { return 1e20 + 1e5; }));
+        KSS_ASSERT(isCloseTo<float>(1.0f, FloatTolerance(), [] { return nextafter(1.0f, 2.0f); }));
+    }),
+    make_pair("failure details", [] {
+        const auto child = runChild("child ranges");
+        KSS_ASSERT(child.status != 0);
+        KSS_ASSERT(contains(child.output,
+            "↳2 of 3000000 elements failed the predicate: [17] (5000000), [2999999] (5000000)\n"));
+        KSS_ASSERT(contains(child.output,
+            "↳20 of 2000000 elements differ: [100] expected (100), actual was (0), "
+            "[100100] expected (100100), actual was (0)"));
+        KSS_ASSERT(contains(child.output,
+            "[900100] expected (900100), actual was (0), ...\n"));
+        KSS_ASSERT(contains(child.output,
+            "↳sizes differ, expected 3, actual was 2; 1 of 2 elements differ: "
+            "[1] expected (2), actual was (3)\n"));
+        KSS_ASSERT(contains(child.output,
+            "↳5 of 1000 elements differ: [10] expected (1), actual was (1.00000012), "
+            "[20] expected (1), actual was (1.00000012), [30] expected (1), actual was (1.00000012), "
+            "[40] expected (1), actual was (1.00000048), [50] expected (1), actual was (nan); "
+            "max abs error 4.76837158e-07 at [40], max ulp error 4 at [40]; "
+            "ulp error histogram: 0 x995, 1 x3, 4-7 x1, NaN/inf x1\n"));
+    })
+});
+
+// Failing assertions, run in a child process by "failure details" above.
+static TestSuite childTs("child ranges", {
+    make_pair("KSS_ASSERT_ALL", [] {
+        if (!isChild()) { return; }
+        vector<unsigned> v(3'000'000);
+        iota(v.begin(), v.end(), 0U);
+        v[2'999'999] = 5'000'000;
+        v[17] = 5'000'000;
+        KSS_ASSERT_ALL(v, [](unsigned i) { return i < 3'000'000U; });
+    }),
+    make_pair("KSS_ASSERT_EQUAL_RANGES", [] {
+        if (!isChild()) { return; }
+        vector<uint64_t> a(2'000'000);
+        iota(a.begin(), a.end(), uint64_t(0));
+        vector<uint64_t> b = a;
+        for (size_t i = 100; i < b.size(); i += 100'000) {
+            b[i] = 0;
+        }
+        KSS_ASSERT_EQUAL_RANGES(a, b);
+        KSS_ASSERT_EQUAL_RANGES((list<int>{ 1, 2, 3 }), (list<int>{ 1, 3 }));
+    }),
+    make_pair("rangesAreClose", [] {
+        if (!isChild()) { return; }
+        vector<float> expected(1000, 1.0f);
+        vector<float> actual = expected;
+        actual[10] = actual[20] = actual[30] = nextafter(1.0f, 2.0f);
+        for (int i = 0; i < 4; ++i) {
+            actual[40] = nextafter(actual[40], 2.0f);
+        }
+        actual[50] = numeric_limits<float>::quiet_NaN();
+        KSS_ASSERT(rangesAreClose(expected, actual, FloatTolerance{ 0.0, 0.0, 0 }));
+    })
+});
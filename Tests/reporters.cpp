@@ -0,0 +1,83 @@
+//
+//  reporters.cpp
+//  unittest
+//
+//  Created by Steven W. Klassen on 2026-10-18.
+//  Copyright © 2026 Klassen Software Solutions. All rights reserved.
+//  Licensing follows the MIT License.
+//
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <kss/test/all.h>
+
+#include "helpers.hpp"
+
+using namespace std;
+using namespace kss::test;
+using namespace helpers;
+
+
+namespace {
+    atomic<bool> runHasStarted { false };
+    atomic<bool> suiteHasStarted { false };
+
+    // Records the events that this test suite is interested in. The events arrive
+    // asynchronously, hence the tests wait for them.
+    class RecordingReporter : public Reporter {
+    public:
+        void report(const Event& event) override {
+            if (event.kind == Event::Kind::RunStarted) {
+                runHasStarted = true;
+            }
+            else if (event.kind == Event::Kind::SuiteStarted && event.suite == "reporters") {
+                suiteHasStarted = true;
+            }
+        }
+    };
+
+    bool eventually(const atomic<bool>& flag) {
+        for (int i = 0; i < 1000 && !flag; ++i) {
+            this_thread::sleep_for(1ms);
+        }
+        return flag;
+    }
+
+    // Reporters must be added before run() is called, which a static initializer does.
+    const bool hasReporter = [] {
+        addReporter(make_shared<RecordingReporter>());
+        return true;
+    }();
+}
+
+static TestSuite ts("reporters", {
+    make_pair("receives events", [] {
+        KSS_ASSERT(hasReporter);
+        KSS_ASSERT(eventually(runHasStarted));
+        KSS_ASSERT(eventually(suiteHasStarted));
+    }),
+    make_pair("tap escapes control characters", [] {
+        const TemporaryDirectory dir("ksstest-reporters");
+        const auto tap = dir.filename("results.tap");
+        const auto child = runChild("child tap", { "--tap=" + tap });
+        KSS_ASSERT(child.status != 0);
+
+        // The message stays on one line of the YAML block, with nothing left unescaped.
+        const auto contents = readFile(tap);
+        KSS_ASSERT(contains(contents, "not ok 1 - child tap: control characters"));
+        KSS_ASSERT(contains(contents, "  error: \"std::runtime_error: tab\\there\\r\\nbell\\x07 \\\"quoted\\\"\"\n"));
+        KSS_ASSERT(!contains(contents, "\r"));
+        KSS_ASSERT(!contains(contents, "\x07"));
+    })
+});
+
+// Run in a child process by "tap escapes control characters" above.
+static TestSuite childTs("child tap", {
+    make_pair("control characters", [] {
+        if (!isChild()) { return; }
+        throw runtime_error("tab\there\r\nbell\x07 \"quoted\"");
+    })
+});
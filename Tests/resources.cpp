@@ -0,0 +1,138 @@
+//
+//  resources.cpp
+//  unittest
+//
+//  Created by Steven W. Klassen on 2026-10-18.
+//  Copyright © 2026 Klassen Software Solutions. All rights reserved.
+//  Licensing follows the MIT License.
+//
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <kss/test/all.h>
+
+#include "helpers.hpp"
+
+using namespace std;
+using namespace kss::test;
+using namespace helpers;
+
+
+namespace {
+    atomic<int> numberUsingExclusiveResource { 0 };
+
+    class ExclusiveResourceSuite : public TestSuite, public UsesResources {
+    public:
+        ExclusiveResourceSuite(const string& name, test_case_list_t fns) : TestSuite(name, fns) {}
+
+        resources_t resources() const override {
+            return { { "resources test", 1 } };
+        }
+    };
+
+    class GreedySuite : public TestSuite, public UsesResources {
+    public:
+        GreedySuite(const string& name, test_case_list_t fns) : TestSuite(name, fns) {}
+
+        resources_t resources() const override {
+            return { { "cores", 100000 }, { "memoryMB", 1 } };
+        }
+    };
+
+    // Each of the suites using the exclusive resource checks that no other is using it
+    // at the same time. The greedy suite checks the same, since needing all the cores
+    // should keep every other suite from running alongside it.
+    void useExclusiveResource() {
+        KSS_ASSERT(++numberUsingExclusiveResource == 1);
+        this_thread::sleep_for(20ms);
+        KSS_ASSERT(--numberUsingExclusiveResource == 0);
+    }
+
+    // Allocate 48MB in blocks small enough to come from the heap, rather than being
+    // mapped separately, and hold on to it for long enough to be sampled.
+    void allocateAndFree() {
+        vector<unique_ptr<char[]>> blocks;
+        for (int i = 0; i < 3072; ++i) {
+            blocks.emplace_back(new char[16 * 1024]);
+            memset(blocks.back().get(), i, 16 * 1024);
+        }
+        this_thread::sleep_for(50ms);
+    }
+
+    map<string, unsigned> readMemoryEstimates(const string& filename) {
+        map<string, unsigned> estimates;
+        ifstream strm(filename);
+        unsigned mb = 0;
+        string name;
+        while (strm >> mb && getline(strm >> ws, name)) {
+            estimates[name] = mb;
+        }
+        return estimates;
+    }
+}
+
+static ExclusiveResourceSuite ts1("resources 1", {
+    make_pair("exclusive", useExclusiveResource)
+});
+
+static ExclusiveResourceSuite ts2("resources 2", {
+    make_pair("exclusive", useExclusiveResource)
+});
+
+static ExclusiveResourceSuite ts3("resources 3", {
+    make_pair("exclusive", useExclusiveResource)
+});
+
+static GreedySuite ts4("resources greedy", {
+    make_pair("more than the capacity", [] {
+        // Needing more than the capacity is treated as needing all of it.
+        useExclusiveResource();
+    })
+});
+
+static TestSuite ts5("resources memory estimates", {
+    make_pair("--memory-estimates", [] {
+        const TemporaryDirectory dir("ksstest-resources");
+        const auto filename = dir.write("estimates.txt", "7 child memory not run\n");
+        const auto child = runChild("child memory", { "--no-parallel", "--memory-estimates=" + filename });
+        KSS_ASSERT(child.status == 0);
+
+        // The second suite reuses the memory freed by the first, which would not show up
+        // in the resident set size. The estimates of suites that did not run are kept.
+        auto estimates = readMemoryEstimates(filename);
+        KSS_ASSERT(estimates.size() == 4);
+        KSS_ASSERT(estimates["child memory 1 allocates"] >= 40 && estimates["child memory 1 allocates"] <= 64);
+        KSS_ASSERT(estimates["child memory 2 reuses"] >= 40 && estimates["child memory 2 reuses"] <= 64);
+        KSS_ASSERT(estimates["child memory 3 idle"] <= 1);
+        KSS_ASSERT(estimates["child memory not run"] == 7);
+    })
+});
+
+// Run in a child process by "--memory-estimates" above.
+static TestSuite childTs1("child memory 1 allocates", {
+    make_pair("allocates", [] {
+        if (!isChild()) { return; }
+        allocateAndFree();
+    })
+});
+
+static TestSuite childTs2("child memory 2 reuses", {
+    make_pair("reuses", [] {
+        if (!isChild()) { return; }
+        allocateAndFree();
+    })
+});
+
+static TestSuite childTs3("child memory 3 idle", {
+    make_pair("idle", [] {
+        if (!isChild()) { return; }
+        this_thread::sleep_for(50ms);
+    })
+});
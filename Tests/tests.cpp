@@ -10,11 +10,18 @@
 #include <kss/test/all.h>
 #include <cassert>
 #include <cerrno>
+#include <csignal>
+#include <cstdlib>
 #include <stdexcept>
+#include <thread>
+#include <vector>
 #include <kss/test/all.h>
 
+#include "helpers.hpp"
+
 using namespace std;
 using namespace kss::test;
+using namespace helpers;
 
 
 #pragma clang diagnostic push
@@ -59,6 +66,17 @@ make_pair("function", myFunctionTest),
 make_pair("functional", myFunctionalTest()),
 make_pair("testTerminate", []{
     KSS_ASSERT(terminates([]{ should_call_terminate(); }));
+    KSS_ASSERT(!terminates([]{}));
+    KSS_ASSERT(!terminates([]{ throw runtime_error("hi"); }));
+}),
+make_pair("testDeathTests", []{
+    KSS_ASSERT(exitsWith(3, []{ exit(3); }));
+    KSS_ASSERT(exitsWith(0, []{ _Exit(0); }));
+    KSS_ASSERT(!exitsWith(0, []{}));
+    KSS_ASSERT(!exitsWith(3, []{ exit(4); }));
+    KSS_ASSERT(killedBySignal(SIGABRT, []{ abort(); }));
+    KSS_ASSERT(!killedBySignal(SIGSEGV, []{ abort(); }));
+    KSS_ASSERT(!exitsWith(0, []{ this_thread::sleep_for(10s); }, 50ms));
 }),
 make_pair("testAssertionTypes", []{
     KSS_ASSERT(isTrue([]{ return true; }));
@@ -75,6 +93,31 @@ make_pair("testAssertionTypes", []{
     }));
     KSS_ASSERT(completesWithin(1s, []{}));
 }),
+make_pair("isFasterThan", [] {
+    KSS_ASSERT(isFasterThan([]{}, []{ this_thread::sleep_for(1ms); }, 2.0));
+    KSS_ASSERT(!isFasterThan([]{ this_thread::sleep_for(1ms); }, []{}));
+    KSS_ASSERT(throwsException<invalid_argument>([]{ (void)isFasterThan([]{}, []{}, 0.0); }));
+}),
+make_pair("matchesReference", [] {
+    auto reference = [](unsigned n) { unsigned sum = 0; for (unsigned i = 1; i <= n; ++i) { sum += i; } return sum; };
+    auto index = [](size_t i) { return unsigned(i); };
+    KSS_ASSERT(matchesReference(reference, [](unsigned n) { return n * (n + 1) / 2; }, index, 10000));
+    KSS_ASSERT(!matchesReference(reference, [](unsigned n) { return (n < 5000 ? n * (n + 1) / 2 : 0U); }, index, 10000));
+
+    // The details give the first divergent input, even though the checking is split
+    // across threads, along with both outputs.
+    const auto child = runChild("child matchesReference");
+    KSS_ASSERT(child.status == 1);
+    KSS_ASSERT(contains(child.output,
+        "↳diverged at input 5000 (5000), reference was (12502500), optimized was (0)\n"));
+}),
+make_pair("instructionsPerCallBelow", [] {
+    // Without an instruction counter every call passes.
+    volatile unsigned sum = 0;
+    auto heavy = [&]{ for (unsigned i = 0; i < 10000; ++i) { sum = sum + i; } };
+    KSS_ASSERT(instructionsPerCallBelow(100000, [&]{ sum = sum + 1; }));
+    KSS_ASSERT(instructionsPerCallBelow(1000, heavy) == !instructionCountersAvailable());
+}),
 make_pair("isCloseTo", [] {
     KSS_ASSERT(isCloseTo<int>(10, 2, []{ return 11; }));
     KSS_ASSERT(isCloseTo<int>(10, []{ return 10; }));
@@ -93,6 +136,17 @@ make_pair("quiet and verbose", [] {
     if (isVerbose()) { KSS_ASSERT(!isQuiet()); }
     if (isQuiet()) { KSS_ASSERT(!isVerbose()); }
 }),
+make_pair("seed", [] {
+    // The seed is chosen per run, but a thread with our context must see the same one.
+    const auto s = seed();
+    KSS_ASSERT(isEqualTo<uint64_t>(s, [&] {
+        uint64_t threadSeed = 0;
+        {
+            Thread th { [&] { threadSeed = seed(); } };
+        }
+        return threadSeed;
+    }));
+}),
 make_pair("isLessThan", [] {
     KSS_ASSERT(isLessThan<int>(10, []{ return 9; }));
     KSS_ASSERT(isLessThan<double>(-10., []{ return -11.; }));
@@ -132,3 +186,57 @@ static TestSuite ts2("TestSuite with Failures", {
 		KSS_ASSERT(false);
 	})
 });
+
+namespace {
+    // Needing all the cores keeps the other suites from running at the same time, which
+    // would make the times too noisy to tell n from n log n.
+    class ExclusiveSuite : public TestSuite, public UsesResources {
+    public:
+        ExclusiveSuite(const string& name, test_case_list_t fns) : TestSuite(name, fns) {}
+
+        resources_t resources() const override {
+            return { { "cores", 100000 } };
+        }
+    };
+}
+
+static ExclusiveSuite ts3("scalesAs", {
+    make_pair("scalesAs", [] {
+        // Compute bound, so that the times are not affected by the sizes of the caches. The
+        // inner loop of the n log n code does enough work to hide the cost of the outer one,
+        // which would otherwise add a linear term.
+        auto makeCount = [](size_t n) { return n; };
+        auto linear = [](size_t& n) {
+            size_t sum = 0;
+            for (size_t i = 0; i < n; ++i) { sum += i; doNotOptimize(sum); }
+        };
+        auto nLogN = [](size_t& n) {
+            size_t sum = 0;
+            for (size_t i = 0; i < n; ++i) {
+                for (size_t j = n; j > 1; j >>= 1) {
+                    for (size_t k = 0; k < 4; ++k) { sum += i ^ j ^ k; doNotOptimize(sum); }
+                }
+            }
+        };
+        auto quadratic = [](size_t& n) {
+            size_t sum = 0;
+            for (size_t i = 0; i < n; ++i) { for (size_t j = 0; j < n; ++j) { sum += i * j; doNotOptimize(sum); } }
+        };
+        const auto sizes = geometricSizes(1 << 8, 1 << 20, 4);
+        KSS_ASSERT(scalesAs(Complexity::N, sizes, makeCount, linear));
+        KSS_ASSERT(!scalesAs(Complexity::N, sizes, makeCount, nLogN));
+        KSS_ASSERT(scalesAs(Complexity::NLogN, sizes, makeCount, nLogN));
+        KSS_ASSERT(!scalesAs(Complexity::N, geometricSizes(125, 4000), makeCount, quadratic));
+        KSS_ASSERT(throwsException<invalid_argument>([]{ (void)geometricSizes(0, 10); }));
+    })
+});
+
+// A failing matchesReference, run in a child process by "matchesReference" above.
+static TestSuite ts4("child matchesReference", {
+    make_pair("diverges", [] {
+        if (!isChild()) { return; }
+        auto reference = [](unsigned n) { unsigned sum = 0; for (unsigned i = 1; i <= n; ++i) { sum += i; } return sum; };
+        auto optimized = [](unsigned n) { return (n < 5000 || n > 9000 ? n * (n + 1) / 2 : 0U); };
+        KSS_ASSERT(matchesReference(reference, optimized, [](size_t i) { return unsigned(i); }, 10000));
+    })
+});
@@ -0,0 +1,120 @@
+//
+//  threads.cpp
+//  unittest
+//
+//  Created by Steven W. Klassen on 2026-10-18.
+//  Copyright © 2026 Klassen Software Solutions. All rights reserved.
+//  Licensing follows the MIT License.
+//
+
+#include <atomic>
+#include <future>
+#include <vector>
+#include <kss/test/all.h>
+
+using namespace std;
+using namespace kss::test;
+
+
+namespace {
+    // Trivial executor used to check TestCaseContextExecutor.
+    struct AsyncExecutor {
+        vector<future<void>> futures;
+
+        template <class Fn>
+        void execute(Fn&& fn) {
+            futures.push_back(async(launch::async, std::forward<Fn>(fn)));
+        }
+    };
+}
+
+static TestSuite ts("threads", {
+    make_pair("Thread", [] {
+        auto& suite = TestSuite::get();
+        Thread th { [&suite] {
+            KSS_ASSERT(&TestSuite::get() == &suite);
+        }};
+        th.join();
+        KSS_ASSERT(!th.joinable());
+
+        // Destruction should join rather than terminate.
+        Thread th2 { [](int i) { KSS_ASSERT(i == 3); }, 3 };
+    }),
+    make_pair("withTestCaseContext", [] {
+        auto fut = async(launch::async, withTestCaseContext([] {
+            KSS_ASSERT(true);
+            return 7;
+        }));
+        KSS_ASSERT(fut.get() == 7);
+    }),
+    make_pair("TestCaseContextExecutor", [] {
+        AsyncExecutor pool;
+        TestCaseContextExecutor<AsyncExecutor> ex(pool);
+        for (int i = 0; i < 4; ++i) {
+            ex.execute([i] { KSS_ASSERT(i >= 0); });
+        }
+        for (auto& fut : pool.futures) {
+            fut.wait();
+        }
+    }),
+    make_pair("parallelFor", [] {
+        vector<int> v(10000, 0);
+        parallelFor(0, v.size(), [&](size_t i) {
+            v[i] = int(i);
+            KSS_ASSERT(v[i] >= 0);
+        });
+        KSS_ASSERT(isTrue([&] {
+            for (size_t i = 0; i < v.size(); ++i) {
+                if (v[i] != int(i)) return false;
+            }
+            return true;
+        }));
+
+        atomic<unsigned> count { 0 };
+        parallelFor(5, 5, [&](size_t) { ++count; });
+        KSS_ASSERT(count == 0);
+
+        KSS_ASSERT(throwsException<runtime_error>([] {
+            parallelFor(0, 100, [](size_t i) {
+                if (i == 50) throw runtime_error("fifty");
+            });
+        }));
+    }),
+    make_pair("executor", [] {
+        auto& ex = executor();
+        KSS_ASSERT(ex.concurrency() > 0);
+
+        atomic<int> count { 0 };
+        vector<Executor::task_t> tasks;
+        for (int i = 0; i < 20; ++i) {
+            tasks.push_back(ex.submit([&count] {
+                KSS_ASSERT(true);
+                ++count;
+            }));
+        }
+        ex.wait(tasks);
+        KSS_ASSERT(count == 20);
+
+        KSS_ASSERT(throwsException<runtime_error>([&ex] {
+            ex.wait(ex.submit([] { throw runtime_error("hi"); }));
+        }));
+    }),
+    make_pair("executor nested wait", [] {
+        // Tasks that wait on other tasks must not deadlock, even when there are more
+        // of them than there are workers.
+        auto& ex = executor();
+        atomic<int> count { 0 };
+        vector<Executor::task_t> outer;
+        for (unsigned i = 0; i < ex.concurrency() * 2; ++i) {
+            outer.push_back(ex.submit([&ex, &count] {
+                vector<Executor::task_t> inner;
+                for (int j = 0; j < 4; ++j) {
+                    inner.push_back(ex.submit([&count] { ++count; }));
+                }
+                ex.wait(inner);
+            }));
+        }
+        ex.wait(outer);
+        KSS_ASSERT(count == int(ex.concurrency() * 2 * 4));
+    })
+});